@@ -0,0 +1,169 @@
+/******************************************************************************
+ * include/ips4o/abbreviation.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "projection.hpp"
+
+namespace ips4o {
+
+/**
+ * Abbreviates strings to their first eight bytes.
+ * The abbreviations order like the strings, shorter strings padded with zeros.
+ */
+struct string_prefix {
+    template <class String>
+    std::uint64_t operator()(const String& str) const {
+        const auto size = str.size();
+        const auto* data = reinterpret_cast<const unsigned char*>(str.data());
+        std::uint64_t prefix = 0;
+        if (size >= sizeof(prefix)) {
+            std::memcpy(&prefix, data, sizeof(prefix));
+            return __builtin_bswap64(prefix);
+        }
+        for (std::size_t i = 0; i < size; ++i)
+            prefix |= static_cast<std::uint64_t>(data[i]) << (56 - 8 * i);
+        return prefix;
+    }
+};
+
+namespace detail {
+
+/**
+ * Compares abbreviations first and calls the full comparator only on ties.
+ */
+template <class Comp, class Abbrev>
+class AbbreviatedLess {
+ public:
+    AbbreviatedLess(Comp comp, Abbrev abbrev)
+        : comp_(std::move(comp)), abbrev_(std::move(abbrev)) {}
+
+    template <class T, class U>
+    bool operator()(const T& lhs, const U& rhs) const {
+        const std::uint64_t l = abbrev_(lhs);
+        const std::uint64_t r = abbrev_(rhs);
+        return l < r || (l == r && comp_(lhs, rhs));
+    }
+
+    const Comp& comparator() const { return comp_; }
+
+    const Abbrev& abbreviation() const { return abbrev_; }
+
+ private:
+    Comp comp_;
+    Abbrev abbrev_;
+};
+
+/**
+ * Access to the abbreviations of a comparator on keys.
+ * Comparators without abbreviations ignore them.
+ */
+template <class KeyLess>
+struct Abbreviation {
+    template <class T>
+    static std::uint64_t abbrev(const KeyLess&, const T&) {
+        return 0;
+    }
+
+    template <class T, class U>
+    static bool less(const KeyLess& comp, std::uint64_t, const T& lhs, std::uint64_t,
+                     const U& rhs) {
+        return comp(lhs, rhs);
+    }
+
+    static constexpr const bool kEnabled = false;
+};
+
+template <class Comp, class Abbrev>
+struct Abbreviation<AbbreviatedLess<Comp, Abbrev>> {
+    using KeyLess = AbbreviatedLess<Comp, Abbrev>;
+
+    template <class T>
+    static std::uint64_t abbrev(const KeyLess& comp, const T& key) {
+        return comp.abbreviation()(key);
+    }
+
+    template <class T, class U>
+    static bool less(const KeyLess& comp, std::uint64_t l, const T& lhs, std::uint64_t r,
+                     const U& rhs) {
+        return l < r || (l == r && comp.comparator()(lhs, rhs));
+    }
+
+    static constexpr const bool kEnabled = true;
+};
+
+/**
+ * Access to the abbreviations of the projected keys of values.
+ */
+template <class Less>
+struct ValueAbbreviation {
+    using projection = Projection<Less>;
+    using abbreviation = Abbreviation<typename projection::key_less>;
+
+    template <class T>
+    static std::uint64_t abbrev(const Less& comp, const T& value) {
+        return abbreviation::abbrev(projection::keyLess(comp),
+                                    projection::key(comp, value));
+    }
+
+    template <class T>
+    static bool less(const Less& comp, std::uint64_t l, const T& lhs, std::uint64_t r,
+                     const T& rhs) {
+        return abbreviation::less(projection::keyLess(comp), l,
+                                  projection::key(comp, lhs), r,
+                                  projection::key(comp, rhs));
+    }
+
+    static constexpr const bool kEnabled = abbreviation::kEnabled;
+};
+
+}  // namespace detail
+
+/**
+ * Wraps a comparator with an abbreviation hook.
+ * The hook must map keys to integers such that abbrev(a) < abbrev(b) implies a < b;
+ * equal abbreviations are resolved by the comparator.
+ */
+template <class Comp, class Abbrev>
+detail::AbbreviatedLess<Comp, Abbrev> abbreviated(Comp comp, Abbrev abbrev) {
+    return {std::move(comp), std::move(abbrev)};
+}
+
+}  // namespace ips4o
@@ -36,11 +36,18 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
 #include <utility>
-#include <vector>
 
+#include "abbreviation.hpp"
 #include "ips4o_fwd.hpp"
+#include "projection.hpp"
+#include "simd_sort.hpp"
 #include "utils.hpp"
 
 namespace ips4o {
@@ -70,29 +77,234 @@ void insertionSort(const It begin, const It end, Comp comp) {
 }
 
 /**
- * Wrapper for base case sorter, for easier swapping.
+ * Insertion sort which computes each abbreviation once.
+ * Only the full comparator is called on equal abbreviations.
  */
 template <class It, class Comp>
-inline void baseCaseSort(It begin, It end, Comp&& comp) {
-    if (begin == end) return;
+void abbreviatedInsertionSort(const It begin, const It end, const Comp& comp) {
+    using Abbrev = ValueAbbreviation<Comp>;
+    constexpr const std::ptrdiff_t kMaxSize = 512;
+    IPS4OML_ASSUME_NOT(begin >= end);
+
+    const auto n = end - begin;
+    if (n > kMaxSize) {
+        detail::insertionSort(begin, end, comp);
+        return;
+    }
+
+    std::uint64_t abbrevs[kMaxSize];
+    for (std::ptrdiff_t i = 0; i < n; ++i)
+        abbrevs[i] = Abbrev::abbrev(comp, begin[i]);
+
+    for (std::ptrdiff_t i = 1; i < n; ++i) {
+        typename std::iterator_traits<It>::value_type val = std::move(begin[i]);
+        const std::uint64_t abbrev = abbrevs[i];
+        auto j = i;
+        while (j > 0 && Abbrev::less(comp, abbrev, val, abbrevs[j - 1], begin[j - 1])) {
+            begin[j] = std::move(begin[j - 1]);
+            abbrevs[j] = abbrevs[j - 1];
+            --j;
+        }
+        begin[j] = std::move(val);
+        abbrevs[j] = abbrev;
+    }
+}
+
+/**
+ * Comparators which compile to branch-free code on arithmetic values.
+ */
+template <class Comp, class T>
+struct IsBranchlessComparator
+    : std::integral_constant<
+              bool, std::is_arithmetic<T>::value
+                            && (std::is_same<Comp, std::less<>>::value
+                                || std::is_same<Comp, std::less<T>>::value
+                                || std::is_same<Comp, std::greater<>>::value
+                                || std::is_same<Comp, std::greater<T>>::value)> {};
+
+template <class Comp, class Proj, class T>
+struct IsBranchlessComparator<ProjectedLess<Comp, Proj>, T> {
+    using key_type = std::decay_t<decltype(std::declval<const Proj&>()(
+            std::declval<const T&>()))>;
+    static constexpr const bool value =
+            std::is_arithmetic<T>::value && IsBranchlessComparator<Comp, key_type>::value;
+};
+
+/**
+ * Orders two values without branching.
+ */
+template <class T, class Comp>
+inline void compareExchange(T& a, T& b, const Comp& comp) {
+    const bool swap = comp(b, a);
+    const T lo = swap ? b : a;
+    const T hi = swap ? a : b;
+    a = lo;
+    b = hi;
+}
+
+/**
+ * Optimal sorting networks for up to eight values.
+ */
+template <class T, class Comp>
+inline void sortingNetwork8(T* v, const int n, const Comp& comp) {
+    const auto cx = [v, &comp](int i, int j) { compareExchange(v[i], v[j], comp); };
+    switch (n) {
+        case 2:
+            cx(0, 1);
+            break;
+        case 3:
+            cx(0, 2); cx(0, 1); cx(1, 2);
+            break;
+        case 4:
+            cx(0, 2); cx(1, 3); cx(0, 1); cx(2, 3); cx(1, 2);
+            break;
+        case 5:
+            cx(0, 3); cx(1, 4); cx(0, 2); cx(1, 3); cx(0, 1); cx(2, 4); cx(1, 2);
+            cx(3, 4); cx(2, 3);
+            break;
+        case 6:
+            cx(0, 5); cx(1, 3); cx(2, 4); cx(1, 2); cx(3, 4); cx(0, 3); cx(2, 5);
+            cx(0, 1); cx(2, 3); cx(4, 5); cx(1, 2); cx(3, 4);
+            break;
+        case 7:
+            cx(0, 6); cx(2, 3); cx(4, 5); cx(0, 2); cx(1, 4); cx(3, 6); cx(0, 1);
+            cx(2, 5); cx(3, 4); cx(1, 2); cx(4, 6); cx(2, 3); cx(4, 5); cx(1, 2);
+            cx(3, 4); cx(5, 6);
+            break;
+        case 8:
+            cx(0, 2); cx(1, 3); cx(4, 6); cx(5, 7); cx(0, 4); cx(1, 5); cx(2, 6);
+            cx(3, 7); cx(0, 1); cx(2, 3); cx(4, 5); cx(6, 7); cx(2, 4); cx(3, 5);
+            cx(1, 4); cx(3, 6); cx(1, 2); cx(3, 4); cx(5, 6);
+            break;
+    }
+}
+
+/**
+ * Sorting network for up to 16 values, with 60 comparators in 10 layers.
+ * Comparators involving positions beyond n are skipped, as if padded with maxima.
+ */
+template <class T, class Comp>
+inline void sortingNetwork16(T* v, const int n, const Comp& comp) {
+    const auto cx = [v, n, &comp](int i, int j) {
+        if (j < n) compareExchange(v[i], v[j], comp);
+    };
+    cx(0, 13); cx(1, 12); cx(2, 15); cx(3, 14); cx(4, 8); cx(5, 6); cx(7, 11); cx(9, 10);
+    cx(0, 5); cx(1, 7); cx(2, 9); cx(3, 4); cx(6, 13); cx(8, 14); cx(10, 15); cx(11, 12);
+    cx(0, 1); cx(2, 3); cx(4, 5); cx(6, 8); cx(7, 9); cx(10, 11); cx(12, 13); cx(14, 15);
+    cx(0, 2); cx(1, 3); cx(4, 10); cx(5, 11); cx(6, 7); cx(8, 9); cx(12, 14); cx(13, 15);
+    cx(1, 2); cx(3, 12); cx(4, 6); cx(5, 7); cx(8, 10); cx(9, 11); cx(13, 14);
+    cx(1, 4); cx(2, 6); cx(5, 8); cx(7, 10); cx(9, 13); cx(11, 14);
+    cx(2, 4); cx(3, 6); cx(9, 12); cx(11, 13);
+    cx(3, 5); cx(6, 8); cx(7, 9); cx(10, 12);
+    cx(3, 4); cx(5, 6); cx(7, 8); cx(9, 10); cx(11, 12);
+    cx(6, 7); cx(8, 9);
+}
+
+/**
+ * Merges two sorted ranges without branching on the comparison.
+ */
+template <class T, class Comp>
+inline void branchlessMerge(const T* a, const T* const a_end, const T* b,
+                            const T* const b_end, T* out, const Comp& comp) {
+    while (a != a_end && b != b_end) {
+        const bool take_b = comp(*b, *a);
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+    out = std::copy(a, a_end, out);
+    std::copy(b, b_end, out);
+}
+
+/**
+ * Sorts runs with sorting networks and merges them bottom-up.
+ * Runs of floating-point values are shorter, as their compare-exchanges have a
+ * longer latency.
+ */
+template <class It, class Comp>
+void networkSort(const It begin, const It end, const Comp& comp) {
+    using T = typename std::iterator_traits<It>::value_type;
+    constexpr const std::ptrdiff_t kMaxSize = 256;
+    constexpr const int kRun = std::is_floating_point<T>::value ? 8 : 16;
+    IPS4OML_ASSUME_NOT(begin >= end);
+
+    const auto n = end - begin;
+    if (n > kMaxSize) {
+        detail::insertionSort(begin, end, comp);
+        return;
+    }
+
+    T buffer[2][kMaxSize];
+    for (std::ptrdiff_t i = 0; i < n; i += kRun) {
+        const int m = static_cast<int>(std::min<std::ptrdiff_t>(kRun, n - i));
+        T* const v = buffer[0] + i;
+        std::copy(begin + i, begin + i + m, v);
+        if (m == 16)
+            sortingNetwork16(v, 16, comp);
+        else if (m > 8)
+            sortingNetwork16(v, m, comp);
+        else
+            sortingNetwork8(v, m, comp);
+    }
+
+    int cur = 0;
+    for (std::ptrdiff_t width = kRun; width < n; width *= 2, cur = !cur) {
+        for (std::ptrdiff_t i = 0; i < n; i += 2 * width) {
+            const auto mid = std::min(i + width, n);
+            const auto stop = std::min(i + 2 * width, n);
+            branchlessMerge(buffer[cur] + i, buffer[cur] + mid, buffer[cur] + mid,
+                            buffer[cur] + stop, buffer[!cur] + i, comp);
+        }
+    }
+    std::copy(buffer[cur], buffer[cur] + n, begin);
+}
+
+template <class It, class Comp>
+inline void comparisonSort(It begin, It end, Comp&& comp, std::false_type) {
     detail::insertionSort(std::move(begin), std::move(end), std::forward<Comp>(comp));
 }
 
-template <class It, class Comp, class ThreadPool>
-inline bool isSorted(It begin, It end, Comp&& comp, ThreadPool& thread_pool) {
-    // Do nothing if input is already sorted.
-    std::vector<bool> is_sorted(thread_pool.numThreads());
-    thread_pool(
-            [begin, end, &is_sorted, &comp](int my_id, int num_threads) {
-                const auto size = end - begin;
-                const auto stripe = (size + num_threads - 1) / num_threads;
-                const auto my_begin = begin + std::min(stripe * my_id, size);
-                const auto my_end = begin + std::min(stripe * (my_id + 1) + 1, size);
-                is_sorted[my_id] = std::is_sorted(my_begin, my_end, comp);
-            },
-            thread_pool.numThreads());
+template <class It, class Comp>
+inline void branchlessSort(It begin, It end, const Comp& comp, std::false_type) {
+    detail::networkSort(std::move(begin), std::move(end), comp);
+}
+
+template <class It, class Comp>
+inline void branchlessSort(It begin, It end, const Comp& comp, std::true_type) {
+    if (!detail::simdSort(begin, end, comp))
+        detail::networkSort(std::move(begin), std::move(end), comp);
+}
+
+template <class It, class Comp>
+inline void comparisonSort(It begin, It end, Comp&& comp, std::true_type) {
+    using value_type = typename std::iterator_traits<It>::value_type;
+    using Simd = UseSimdSort<std::decay_t<Comp>, value_type>;
+    detail::branchlessSort(std::move(begin), std::move(end), comp,
+                           std::integral_constant<bool, Simd::value>{});
+}
 
-    return std::all_of(is_sorted.begin(), is_sorted.end(), [](bool res) { return res; });
+template <class It, class Comp>
+inline void baseCaseSort(It begin, It end, Comp&& comp, std::false_type) {
+    using value_type = typename std::iterator_traits<It>::value_type;
+    using Branchless = IsBranchlessComparator<std::decay_t<Comp>, value_type>;
+    detail::comparisonSort(std::move(begin), std::move(end), std::forward<Comp>(comp),
+                           std::integral_constant<bool, Branchless::value>{});
+}
+
+template <class It, class Comp>
+inline void baseCaseSort(It begin, It end, Comp&& comp, std::true_type) {
+    detail::abbreviatedInsertionSort(std::move(begin), std::move(end), comp);
+}
+
+/**
+ * Wrapper for base case sorter, for easier swapping.
+ */
+template <class It, class Comp>
+inline void baseCaseSort(It begin, It end, Comp&& comp) {
+    if (begin == end) return;
+    using Abbrev = ValueAbbreviation<std::decay_t<Comp>>;
+    detail::baseCaseSort(std::move(begin), std::move(end), std::forward<Comp>(comp),
+                         std::integral_constant<bool, Abbrev::kEnabled>{});
 }
 
 template <class It, class Comp>
@@ -121,5 +333,64 @@ inline bool sortSimpleCases(It begin, It end, Comp&& comp) {
     return false;
 }
 
+/**
+ * Parallel version of the simple case check. Like the sequential version, the
+ * endpoints decide whether the input can only be sorted or only be reverse sorted.
+ * Each thread checks its stripe in chunks and stops as soon as any thread has found
+ * a violation, so unsorted inputs are rejected after reading a few chunks.
+ * Reverse sorted inputs are reversed in parallel.
+ */
+template <class It, class Comp, class ThreadPool>
+bool sortSimpleCases(It begin, It end, Comp&& comp, ThreadPool& thread_pool) {
+    using diff_t = typename std::iterator_traits<It>::difference_type;
+    constexpr diff_t kChunkSize = 4096;
+
+    const diff_t size = end - begin;
+    if (size < 2) return true;
+
+    const bool descending = comp(*(end - 1), *begin);
+    const auto reverse_comp = [&comp](const auto& a, const auto& b) {
+        return comp(b, a);
+    };
+
+    std::atomic<bool> unsorted{false};
+    thread_pool(
+            [&](int my_id, int num_threads) {
+                const diff_t stripe = (size + num_threads - 1) / num_threads;
+                It it = begin + std::min(stripe * my_id, size);
+                // Stripes overlap by one element to check the pairs at the borders
+                const It my_end = begin + std::min(stripe * (my_id + 1) + 1, size);
+                while (my_end - it > 1 && !unsorted.load(std::memory_order_relaxed)) {
+                    const It chunk_end = it + std::min(kChunkSize, diff_t(my_end - it));
+                    const bool ok = descending
+                                            ? std::is_sorted(it, chunk_end, reverse_comp)
+                                            : std::is_sorted(it, chunk_end, comp);
+                    if (!ok) {
+                        unsorted.store(true, std::memory_order_relaxed);
+                        return;
+                    }
+                    it = chunk_end - 1;
+                }
+            },
+            thread_pool.numThreads());
+
+    if (unsorted.load(std::memory_order_relaxed)) return false;
+
+    if (descending) {
+        thread_pool(
+                [begin, end, size](int my_id, int num_threads) {
+                    const diff_t half = size / 2;
+                    const diff_t stripe = (half + num_threads - 1) / num_threads;
+                    const diff_t first = std::min(stripe * my_id, half);
+                    const diff_t last = std::min(stripe * (my_id + 1), half);
+                    std::swap_ranges(begin + first, begin + last,
+                                     std::reverse_iterator<It>(end - first));
+                },
+                thread_pool.numThreads());
+    }
+
+    return true;
+}
+
 }  // namespace detail
 }  // namespace ips4o
@@ -59,6 +59,7 @@ int Sorter<Cfg>::computeOverflowBucket() {
 
 /**
  * Tries to read a block from read_bucket.
+ * Unprocessed blocks have not moved since classification, so their tags are valid.
  */
 template <class Cfg>
 template <bool kEqualBuckets, bool kIsParallel>
@@ -78,7 +79,7 @@ int Sorter<Cfg>::classifyAndReadBlock(const int read_bucket) {
     local_.swap[0].readFrom(begin_ + read);
     if (kIsParallel) bp.stopRead();
 
-    return classifier_->template classify<kEqualBuckets>(local_.swap[0].head());
+    return block_tags_[read / Cfg::kBlockSize];
 }
 
 /**
@@ -108,7 +109,7 @@ int Sorter<Cfg>::swapBlock(const diff_t max_off, const int dest_bucket,
             return -1;
         }
         // Check if block needs to be moved
-        new_dest_bucket = classifier_->template classify<kEqualBuckets>(begin_[write]);
+        new_dest_bucket = block_tags_[write / Cfg::kBlockSize];
     } while (new_dest_bucket == dest_bucket);
 
     // Swap blocks
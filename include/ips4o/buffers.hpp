@@ -152,7 +152,16 @@ class Sorter<Cfg>::Buffers {
     using value_type = typename Cfg::value_type;
 
  public:
-    Buffers(char* storage) : storage_(static_cast<Block*>(static_cast<void*>(storage))) {
+    Buffers(char* storage) {
+        if (storage) setStorage(storage);
+    }
+
+    /**
+     * Places the buffers in the given storage, which holds at least one block for
+     * each bucket that will be used.
+     */
+    void setStorage(char* storage) {
+        storage_ = static_cast<Block*>(static_cast<void*>(storage));
         for (diff_t i = 0; i < Cfg::kMaxBuckets; ++i) {
             resetBuffer(i);
             buffer_[i].end = buffer_[i].ptr + Cfg::kBlockSize;
@@ -228,7 +237,7 @@ class Sorter<Cfg>::Buffers {
     }
 
     Info buffer_[Cfg::kMaxBuckets];
-    Block* storage_;
+    Block* storage_ = nullptr;
     // Blocks should have no extra elements or padding
     static_assert(sizeof(Block) == sizeof(typename Cfg::value_type) * Cfg::kBlockSize,
                   "Block size mismatch.");
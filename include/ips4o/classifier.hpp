@@ -35,10 +35,14 @@
 
 #pragma once
 
+#include <cstdint>
 #include <type_traits>
 #include <utility>
 
+#include "abbreviation.hpp"
 #include "ips4o_fwd.hpp"
+#include "projection.hpp"
+#include "simd_classifier.hpp"
 #include "utils.hpp"
 
 namespace ips4o {
@@ -46,13 +50,19 @@ namespace detail {
 
 /**
  * Branch-free classifier.
+ * Splitters are stored as keys; elements are projected once per classification.
+ * Abbreviated comparators compare splitter abbreviations first.
  */
 template <class Cfg>
 class Sorter<Cfg>::Classifier {
     using iterator = typename Cfg::iterator;
     using value_type = typename Cfg::value_type;
+    using key_type = typename Cfg::key_type;
+    using key_reference = typename Cfg::key_reference;
     using bucket_type = typename Cfg::bucket_type;
     using less = typename Cfg::less;
+    using projection = typename Cfg::projection;
+    using abbreviation = Abbreviation<typename Cfg::key_less>;
 
  public:
     Classifier(less comp) : comp_(std::move(comp)) {}
@@ -66,20 +76,38 @@ class Sorter<Cfg>::Classifier {
      */
     void reset() {
         if (log_buckets_) cleanup();
+        radix_shift_ = -1;
     }
 
     /**
      * The sorted array of splitters, to be filled externally.
      */
-    value_type* getSortedSplitters() {
-        return static_cast<value_type*>(static_cast<void*>(sorted_storage_));
+    key_type* getSortedSplitters() {
+        return static_cast<key_type*>(static_cast<void*>(sorted_storage_));
     }
 
+    /**
+     * Logarithm of the number of buckets, zero if no splitters have been built.
+     */
+    int getLogBuckets() const { return log_buckets_; }
+
     /**
      * The comparison operator.
      */
     less getComparator() const { return comp_; }
 
+    /**
+     * The comparison operator on keys.
+     */
+    const typename Cfg::key_less& keyLess() const { return projection::keyLess(comp_); }
+
+    /**
+     * The key of an element.
+     */
+    key_reference key(const value_type& value) const {
+        return projection::key(comp_, value);
+    }
+
     /**
      * Builds the tree from the sorted splitters.
      */
@@ -89,25 +117,43 @@ class Sorter<Cfg>::Classifier {
         const auto num_splitters = (1 << log_buckets) - 1;
         IPS4OML_ASSUME_NOT(getSortedSplitters() + num_splitters == nullptr);
         new (getSortedSplitters() + num_splitters)
-                value_type(getSortedSplitters()[num_splitters - 1]);
+                key_type(getSortedSplitters()[num_splitters - 1]);
+        if (abbreviation::kEnabled)
+            for (int i = 0; i <= num_splitters; ++i)
+                sorted_abbrevs_[abbrevIndex(i)] =
+                        abbreviation::abbrev(keyLess(), getSortedSplitters()[i]);
         build(getSortedSplitters(), getSortedSplitters() + num_splitters, 1);
     }
 
+    /**
+     * Classifies by the digit of log_buckets bits starting at bit shift.
+     * Only available for radix sorters.
+     */
+    void buildRadix(int shift, int log_buckets) {
+        radix_shift_ = shift;
+        num_buckets_ = 1 << log_buckets;
+    }
+
     /**
      * Classifies a single element.
      */
     template <bool kEqualBuckets>
     bucket_type classify(const value_type& value) const {
+        if (Cfg::kRadixSort && radix_shift_ >= 0)
+            return digit(key(value), std::integral_constant<bool, Cfg::kRadixSort>{});
+
         const int log_buckets = log_buckets_;
         const bucket_type num_buckets = num_buckets_;
         IPS4OML_ASSUME_NOT(log_buckets < 1);
         IPS4OML_ASSUME_NOT(log_buckets > Cfg::kLogBuckets + 1);
 
+        key_reference k = key(value);
+        const std::uint64_t a = abbreviation::abbrev(keyLess(), k);
         bucket_type b = 1;
         for (int l = 0; l < log_buckets; ++l)
-            b = 2 * b + comp_(splitter(b), value);
+            b = 2 * b + splitterLess(b, k, a);
         if (kEqualBuckets)
-            b = 2 * b + !comp_(value, sortedSplitter(b - num_buckets));
+            b = 2 * b + !keyLessSorted(k, a, b - num_buckets);
         return b - (kEqualBuckets ? 2 * num_buckets : num_buckets);
     }
 
@@ -116,6 +162,12 @@ class Sorter<Cfg>::Classifier {
      */
     template <bool kEqualBuckets, class Yield> 
     void classify(iterator begin, iterator end, Yield&& yield) const {
+      if (Cfg::kRadixSort && radix_shift_ >= 0) {
+          for (; begin != end; ++begin)
+              yield(digit(key(*begin), std::integral_constant<bool, Cfg::kRadixSort>{}),
+                    begin);
+          return;
+      }
       classifySwitch<kEqualBuckets>(begin, end, std::forward<Yield>(yield),
 	std::make_integer_sequence<int, Cfg::kLogBuckets + 1>{});
     }
@@ -137,64 +189,194 @@ class Sorter<Cfg>::Classifier {
      */
     template <bool kEqualBuckets, int kLogBuckets, class Yield>
     bool classifyUnrolled(iterator begin, const iterator end, Yield&& yield) const {
+        classifyUnrolled<kEqualBuckets, kLogBuckets>(
+                begin, end, std::forward<Yield>(yield),
+                std::integral_constant<bool, Cfg::kUseSimdClassifier>{});
+        return true;
+    }
+
+ private:
+    /**
+     * Scalar classification, unrolled kUnrollClassifier times.
+     */
+    template <bool kEqualBuckets, int kLogBuckets, class Yield>
+    void classifyUnrolled(iterator begin, const iterator end, Yield&& yield,
+                          std::false_type) const {
 
         constexpr const bucket_type kNumBuckets = 1l << (kLogBuckets + kEqualBuckets);
         constexpr const int kUnroll = Cfg::kUnrollClassifier;
+        // Prefetch descendants once the tree no longer fits into the L1 cache
+        constexpr const bool kPrefetch = (sizeof(key_type) << kLogBuckets) > (16 << 10);
         IPS4OML_ASSUME_NOT(begin >= end);
         IPS4OML_ASSUME_NOT(begin > (end - kUnroll));
 
         bucket_type b[kUnroll];
+        KeyHolder<key_reference> k[kUnroll];
+        std::uint64_t a[kUnroll];
         for (auto cutoff = end - kUnroll; begin <= cutoff; begin += kUnroll) {
-            for (int i = 0; i < kUnroll; ++i)
+            for (int i = 0; i < kUnroll; ++i) {
                 b[i] = 1;
+                k[i].set(key(begin[i]));
+                a[i] = abbreviation::abbrev(keyLess(), k[i].get());
+            }
 
-            for (int l = 0; l < kLogBuckets; ++l)
+            for (int l = 0; l < kLogBuckets; ++l) {
+                if (kPrefetch && l + kPrefetchLevels < kLogBuckets)
+                    for (int i = 0; i < kUnroll; ++i)
+                        prefetchDescendants(b[i]);
                 for (int i = 0; i < kUnroll; ++i)
-                    b[i] = 2 * b[i] + comp_(splitter(b[i]), begin[i]);
+                    b[i] = 2 * b[i] + splitterLess(b[i], k[i].get(), a[i]);
+            }
 
             if (kEqualBuckets)
                 for (int i = 0; i < kUnroll; ++i)
                     b[i] = 2 * b[i]
-                           + !comp_(begin[i], sortedSplitter(b[i] - kNumBuckets / 2));
+                           + !keyLessSorted(k[i].get(), a[i], b[i] - kNumBuckets / 2);
 
             for (int i = 0; i < kUnroll; ++i)
                 yield(b[i] - kNumBuckets, begin + i);
         }
 
+        classifyRemainder<kEqualBuckets, kLogBuckets>(begin, end, yield);
+    }
+
+    /**
+     * Vectorized classification for arithmetic keys.
+     * Keys are read in place if possible, otherwise they are projected into a batch.
+     */
+    template <bool kEqualBuckets, int kLogBuckets, class Yield>
+    void classifyUnrolled(iterator begin, const iterator end, Yield&& yield,
+                          std::true_type) const {
+        using Kernel = SimdKernel<key_type>;
+        constexpr const int kUnroll = Kernel::kLanes >= 16 ? 2 : 4;
+        constexpr const int kBatch = kUnroll * Kernel::kLanes;
+        constexpr const bool kInPlace =
+                projection::kIsIdentity && IsContiguousIterator<iterator>::value;
+        IPS4OML_ASSUME_NOT(begin >= end);
+
+        const key_type* tree = &splitter(0);
+        const key_type* sorted = &sortedSplitter(0);
+        alignas(64) std::int32_t b[kBatch];
+        alignas(64) key_type keys[kInPlace ? 1 : kBatch];
+        for (auto cutoff = end - kBatch; begin <= cutoff; begin += kBatch) {
+            const key_type* in = batchKeys<kBatch>(
+                    begin, keys, std::integral_constant<bool, kInPlace>{});
+            simdClassify<Kernel, kLogBuckets, kEqualBuckets, kUnroll>(tree, sorted, in,
+                                                                      b);
+            for (int i = 0; i < kBatch; ++i)
+                yield(b[i], begin + i);
+        }
+
+        classifyRemainder<kEqualBuckets, kLogBuckets>(begin, end, yield);
+    }
+
+    /**
+     * Keys of a batch of elements, read in place.
+     */
+    template <int kBatch>
+    const key_type* batchKeys(iterator begin, key_type*, std::true_type) const {
+        return &*begin;
+    }
+
+    /**
+     * Keys of a batch of elements, projected into a buffer.
+     */
+    template <int kBatch>
+    const key_type* batchKeys(iterator begin, key_type* keys, std::false_type) const {
+        for (int i = 0; i < kBatch; ++i)
+            keys[i] = key(begin[i]);
+        return keys;
+    }
+
+    /**
+     * Classifies the elements which do not fill a whole unrolled iteration.
+     */
+    template <bool kEqualBuckets, int kLogBuckets, class Yield>
+    void classifyRemainder(iterator begin, const iterator end, Yield&& yield) const {
+        constexpr const bucket_type kNumBuckets = 1l << (kLogBuckets + kEqualBuckets);
         IPS4OML_ASSUME_NOT(begin > end);
         for (; begin != end; ++begin) {
+            key_reference k = key(*begin);
+            const std::uint64_t a = abbreviation::abbrev(keyLess(), k);
             bucket_type b = 1;
             for (int l = 0; l < kLogBuckets; ++l)
-                b = 2 * b + comp_(splitter(b), *begin);
+                b = 2 * b + splitterLess(b, k, a);
             if (kEqualBuckets)
-                b = 2 * b + !comp_(*begin, sortedSplitter(b - kNumBuckets / 2));
+                b = 2 * b + !keyLessSorted(k, a, b - kNumBuckets / 2);
             yield(b - kNumBuckets, begin);
         }
-	return true;
     }
 
- private:
-    const value_type& splitter(bucket_type i) const {
-        return static_cast<const value_type*>(static_cast<const void*>(storage_))[i];
+    /**
+     * Number of tree levels whose nodes below a common ancestor share a cache line.
+     */
+    static constexpr const int kPrefetchLevels =
+            sizeof(key_type) >= 32 ? 1 : log2(64 / sizeof(key_type));
+
+    /**
+     * Prefetches the cache line holding the descendants kPrefetchLevels below node i.
+     * The tree is cache line aligned, so these descendants are contiguous and aligned.
+     */
+    void prefetchDescendants(bucket_type i) const {
+        const auto tree =
+                static_cast<const key_type*>(static_cast<const void*>(storage_));
+        __builtin_prefetch(tree + (i << kPrefetchLevels));
+    }
+
+    /**
+     * Whether the splitter at tree position i is less than a key.
+     */
+    bool splitterLess(bucket_type i, const key_type& key, std::uint64_t abbrev) const {
+        return abbreviation::less(keyLess(), abbrevs_[abbrevIndex(i)], splitter(i),
+                                  abbrev, key);
+    }
+
+    /**
+     * Whether a key is less than the i-th sorted splitter.
+     */
+    bool keyLessSorted(const key_type& key, std::uint64_t abbrev, bucket_type i) const {
+        return abbreviation::less(keyLess(), abbrev, key, sorted_abbrevs_[abbrevIndex(i)],
+                                  sortedSplitter(i));
+    }
+
+    /**
+     * Abbreviations are only stored if the comparator uses them.
+     */
+    static constexpr int abbrevIndex(bucket_type i) {
+        return abbreviation::kEnabled ? i : 0;
+    }
+
+    bucket_type digit(const key_type& key, std::true_type) const {
+        return (RadixKey<key_type>::toUnsigned(key) >> radix_shift_)
+               & (num_buckets_ - 1);
+    }
+
+    bucket_type digit(const key_type&, std::false_type) const { return 0; }
+
+    const key_type& splitter(bucket_type i) const {
+        return static_cast<const key_type*>(static_cast<const void*>(storage_))[i];
     }
 
-    const value_type& sortedSplitter(bucket_type i) const {
-        return static_cast<const value_type*>(
+    const key_type& sortedSplitter(bucket_type i) const {
+        return static_cast<const key_type*>(
                 static_cast<const void*>(sorted_storage_))[i];
     }
 
-    value_type* data() {
-        return static_cast<value_type*>(static_cast<void*>(storage_));
+    key_type* data() {
+        return static_cast<key_type*>(static_cast<void*>(storage_));
     }
 
     /**
      * Recursively builds the tree.
      */
-    void build(const value_type* const left, const value_type* const right,
+    void build(const key_type* const left, const key_type* const right,
                const bucket_type pos) {
         const auto mid = left + (right - left) / 2;
         IPS4OML_ASSUME_NOT(data() + pos == nullptr);
-        new (data() + pos) value_type(*mid);
+        new (data() + pos) key_type(*mid);
+        if (abbreviation::kEnabled)
+            abbrevs_[abbrevIndex(pos)] =
+                    sorted_abbrevs_[abbrevIndex(mid - getSortedSplitters())];
         if (2 * pos < num_buckets_) {
             build(left, mid, 2 * pos);
             build(mid, right, 2 * pos + 1);
@@ -208,20 +390,24 @@ class Sorter<Cfg>::Classifier {
         auto p = data() + 1;
         auto q = getSortedSplitters();
         for (int i = num_buckets_ - 1; i; --i) {
-            p++->~value_type();
-            q++->~value_type();
+            p++->~key_type();
+            q++->~key_type();
         }
-        q->~value_type();
+        q->~key_type();
         log_buckets_ = 0;
     }
 
-    // Filled from 1 to num_buckets_
-    std::aligned_storage_t<sizeof(value_type), alignof(value_type)>
+    // Filled from 1 to num_buckets_, in breadth-first (Eytzinger) order
+    alignas(64) std::aligned_storage_t<sizeof(key_type), alignof(key_type)>
             storage_[Cfg::kMaxBuckets / 2];
     // Filled from 0 to num_buckets_, last one is duplicated
-    std::aligned_storage_t<sizeof(value_type), alignof(value_type)>
+    std::aligned_storage_t<sizeof(key_type), alignof(key_type)>
             sorted_storage_[Cfg::kMaxBuckets / 2];
+    // Abbreviations of storage_ and sorted_storage_
+    std::uint64_t abbrevs_[abbreviation::kEnabled ? Cfg::kMaxBuckets / 2 : 1] = {};
+    std::uint64_t sorted_abbrevs_[abbreviation::kEnabled ? Cfg::kMaxBuckets / 2 : 1] = {};
     int log_buckets_ = 0;
+    int radix_shift_ = -1;
     bucket_type num_buckets_ = 0;
     less comp_;
 };
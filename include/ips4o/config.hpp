@@ -46,6 +46,9 @@
 #include "thread_pool.hpp"
 #endif
 
+#include "projection.hpp"
+#include "simd_classifier.hpp"
+#include "simd_sort.hpp"
 #include "utils.hpp"
 
 #ifndef IPS4OML_ALLOW_EQUAL_BUCKETS
@@ -92,6 +95,30 @@
 #define IPS4OML_UNROLL_CLASSIFIER 7
 #endif
 
+#ifndef IPS4OML_SIMD_CLASSIFIER
+#define IPS4OML_SIMD_CLASSIFIER true
+#endif
+
+#ifndef IPS4OML_SIMD_BASE_CASE_SIZE
+#define IPS4OML_SIMD_BASE_CASE_SIZE 64
+#endif
+
+#ifndef IPS4OML_MAX_NATURAL_RUNS
+#define IPS4OML_MAX_NATURAL_RUNS (64 << 10)
+#endif
+
+#ifndef IPS4OML_SEED_POLICY
+#define IPS4OML_SEED_POLICY ::ips4o::seed_policy::entropy
+#endif
+
+#ifndef IPS4OML_SEED
+#define IPS4OML_SEED 0
+#endif
+
+#ifndef IPS4OML_IMBALANCE_FACTOR_PERCENT
+#define IPS4OML_IMBALANCE_FACTOR_PERCENT 400
+#endif
+
 namespace ips4o {
 
 template <bool AllowEqualBuckets_     = IPS4OML_ALLOW_EQUAL_BUCKETS
@@ -105,6 +132,12 @@ template <bool AllowEqualBuckets_     = IPS4OML_ALLOW_EQUAL_BUCKETS
         , std::ptrdiff_t MinParBlks_  = IPS4OML_MIN_PARALLEL_BLOCKS_PER_THREAD
         , int OversampleF_            = IPS4OML_OVERSAMPLING_FACTOR_PERCENT
         , int UnrollClass_            = IPS4OML_UNROLL_CLASSIFIER
+        , bool SimdClassifier_        = IPS4OML_SIMD_CLASSIFIER
+        , std::ptrdiff_t SimdBaseCase_ = IPS4OML_SIMD_BASE_CASE_SIZE
+        , std::ptrdiff_t MaxRuns_     = IPS4OML_MAX_NATURAL_RUNS
+        , seed_policy SeedPolicy_     = IPS4OML_SEED_POLICY
+        , std::uint64_t Seed_         = IPS4OML_SEED
+        , int ImbalanceF_             = IPS4OML_IMBALANCE_FACTOR_PERCENT
         >
 struct Config {
     /**
@@ -127,14 +160,31 @@ struct Config {
      * Desired base case size.
      */
     static constexpr const std::ptrdiff_t kBaseCaseSize = BaseCase_;
+    /**
+     * Base case size for values sorted by the vectorized base case.
+     * Never smaller than kBaseCaseSize.
+     */
+    static constexpr const std::ptrdiff_t kSimdBaseCaseSize =
+            SimdBaseCase_ < BaseCase_ ? BaseCase_ : SimdBaseCase_;
     /**
      * Multiplier for base case threshold.
      */
     static constexpr const int kBaseCaseMultiplier = BaseCaseM_;
+    /**
+     * Logarithm of the maximum number of buckets (excluding equality buckets).
+     */
+    static constexpr const int kLogBuckets = LogBuckets_;
     /**
      * Number of bytes in one block.
+     * Blocks shrink beyond 256 buckets to bound the size of the per-thread buffers,
+     * down to kMinBlockSizeInBytes.
      */
-    static constexpr const std::ptrdiff_t kBlockSizeInBytes = BlockSize_;
+    static constexpr const std::ptrdiff_t kMinBlockSizeInBytes =
+            BlockSize_ < 512 ? BlockSize_ : 512;
+    static constexpr const std::ptrdiff_t kBlockSizeInBytes =
+            kLogBuckets <= 8 ? BlockSize_
+                             : std::max(BlockSize_ >> (kLogBuckets - 8),
+                                        kMinBlockSizeInBytes);
     /**
      * Alignment for shared and thread-local data.
      */
@@ -143,10 +193,6 @@ struct Config {
      * Number of splitters that must be equal before equality buckets are enabled.
      */
     static constexpr const std::ptrdiff_t kEqualBucketsThreshold = EqualBuckTh_;
-    /**
-     * Logarithm of the maximum number of buckets (excluding equality buckets).
-     */
-    static constexpr const int kLogBuckets = LogBuckets_;
     /**
      * Minimum number of blocks per thread for which parallelism is used.
      */
@@ -157,6 +203,36 @@ struct Config {
      * How many times the classification loop is unrolled.
      */
     static constexpr const int kUnrollClassifier = UnrollClass_;
+    /**
+     * Whether the vectorized classifier may be used for arithmetic keys.
+     */
+    static constexpr const bool kSimdClassifier = SimdClassifier_;
+    /**
+     * Maximum number of natural runs which are merged instead of sample sorted.
+     * Inputs with more than one run per kBaseCaseSize elements are never merged.
+     * Merging allocates scratch memory for the overlapping parts of adjacent runs.
+     * If 1, only sorted and reversed inputs are detected.
+     */
+    static constexpr const std::ptrdiff_t kMaxNaturalRuns = MaxRuns_;
+    static_assert(kMaxNaturalRuns >= 1, "At least one natural run must be allowed.");
+    /**
+     * How the random generators for sampling are seeded, see seed_policy.
+     */
+    static constexpr const seed_policy kSeedPolicy = SeedPolicy_;
+    /**
+     * Base seed for the fixed and per_thread policies.
+     */
+    static constexpr const std::uint64_t kSeed = Seed_;
+    /**
+     * Size of a bucket relative to the average bucket size, in percent, beyond which
+     * a partitioning step counts as imbalanced. The subtask of such a bucket is
+     * processed first.
+     */
+    static constexpr const int kImbalanceFactorPercent = ImbalanceF_;
+    /**
+     * Whether integer keys are distributed by their digits, see RadixConfig.
+     */
+    static constexpr const bool kRadixSort = false;
 
     static constexpr const std::ptrdiff_t kSingleLevelThreshold =
             kBaseCaseSize * (1ul << kLogBuckets);
@@ -175,18 +251,42 @@ struct Config {
     * Computes the logarithm of the number of buckets to use for input size n.
     */
     static int logBuckets(const std::ptrdiff_t n) {
-        if (n <= kSingleLevelThreshold) {
+        return logBucketsFor<kBaseCaseSize>(n);
+    }
+
+    /**
+     * Computes the logarithm of the number of buckets for the given base case size.
+     */
+    template <std::ptrdiff_t BaseCaseSize>
+    static int logBucketsFor(const std::ptrdiff_t n) {
+        constexpr const std::ptrdiff_t kSingleLevel = BaseCaseSize * (1ul << kLogBuckets);
+        constexpr const std::ptrdiff_t kTwoLevel = kSingleLevel * (1ul << kLogBuckets);
+        if (n <= kSingleLevel) {
             // Only one more level until  the base case, reduce the number of buckets
-            return std::max(1ul, detail::log2(n / kBaseCaseSize));
-        } else if (n <= kTwoLevelThreshold) {
+            return std::max(1ul, detail::log2(n / BaseCaseSize));
+        } else if (n <= kTwoLevel) {
             // Only two more levels until we reach the base case, split the buckets evenly
-            return std::max(1ul, (detail::log2(n / kBaseCaseSize) + 1) / 2);
+            return std::max(1ul, (detail::log2(n / BaseCaseSize) + 1) / 2);
         } else {
             // Use the maximum number of buckets
             return kLogBuckets;
         }
     }
 
+    /**
+     * Returns the seed for the random generator of the given thread.
+     */
+    static std::uint64_t seedFor(const int thread_id) {
+        switch (kSeedPolicy) {
+            case seed_policy::fixed:
+                return kSeed;
+            case seed_policy::per_thread:
+                return detail::mixBits(kSeed + 0x9e3779b97f4a7c15u * (thread_id + 1u));
+            default:
+                return detail::entropySeed();
+        }
+    }
+
     /**
      * Returns the number of threads that should be used for the given input range.
      */
@@ -203,6 +303,19 @@ struct Config {
     }
 };
 
+/**
+ * Configuration for MSD radix distribution of integer keys.
+ * Levels whose digit histogram is skewed fall back to sample sort.
+ */
+template <class Cfg = Config<>, int SkewPercent_ = 25>
+struct RadixConfig : public Cfg {
+    static constexpr const bool kRadixSort = true;
+    /**
+     * Maximum share of a single digit in the sample before sample sort is used.
+     */
+    static constexpr const int kRadixSkewPercent = SkewPercent_;
+};
+
 template <class It_, class Comp_, class Cfg = Config<>
 #if defined(_REENTRANT)
           , class ThreadPool_ = DefaultThreadPool
@@ -229,6 +342,20 @@ struct ExtendedConfig : public Cfg {
      * The comparison operator.
      */
     using less = Comp_;
+    /**
+     * Access to the keys compared by the comparison operator.
+     */
+    using projection = detail::Projection<less>;
+    /**
+     * The comparison operator on keys.
+     */
+    using key_less = typename projection::key_less;
+    /**
+     * The result of projecting a value, and the key type stored in the classifier.
+     */
+    using key_reference = decltype(projection::key(std::declval<const less&>(),
+                                                   std::declval<const value_type&>()));
+    using key_type = std::decay_t<key_reference>;
 
 #if defined(_REENTRANT)
 
@@ -263,6 +390,10 @@ struct ExtendedConfig : public Cfg {
 
         void release_threads() {}
 
+        void reset(int) {}
+
+        bool idle() const { return true; }
+
         template <class F>
         void operator()(F&&, int) {}
 
@@ -291,8 +422,36 @@ struct ExtendedConfig : public Cfg {
                             ? 1
                             : (Cfg::kBlockSizeInBytes / sizeof(value_type))));
 
+    /**
+     * Whether the classifier descends the splitter tree with vector instructions.
+     */
+    static constexpr const bool kUseSimdClassifier =
+            Cfg::kSimdClassifier && detail::UseSimdClassifier<key_type, key_less>::value;
+
+    /**
+     * Whether base cases are sorted with vector instructions.
+     */
+    static constexpr const bool kUseSimdBaseCase =
+            detail::UseSimdSort<less, value_type>::value;
+
+    /**
+     * Base case size, larger if the vectorized base case is used.
+     */
+    static constexpr const difference_type kBaseCaseSize =
+            kUseSimdBaseCase ? Cfg::kSimdBaseCaseSize : Cfg::kBaseCaseSize;
+    static constexpr const difference_type kSingleLevelThreshold =
+            kBaseCaseSize * (1ul << Cfg::kLogBuckets);
+    static constexpr const difference_type kTwoLevelThreshold =
+            kSingleLevelThreshold * (1ul << Cfg::kLogBuckets);
+
+    /**
+     * Computes the logarithm of the number of buckets to use for input size n.
+     */
+    static int logBuckets(const difference_type n) {
+        return Cfg::template logBucketsFor<kBaseCaseSize>(n);
+    }
+
     // Redefine applicable constants as difference_type.
-    static constexpr const difference_type kBaseCaseSize = Cfg::kBaseCaseSize;
     static constexpr const difference_type kEqualBucketsThreshold =
             Cfg::kEqualBucketsThreshold;
 
@@ -300,8 +459,15 @@ struct ExtendedConfig : public Cfg {
     static_assert(std::is_same<typename std::iterator_traits<iterator>::iterator_category,
                                std::random_access_iterator_tag>::value,
                   "Iterator must be a random access iterator.");
-    // Number of buckets is limited by switch in classifier
-    static_assert(Cfg::kLogBuckets >=1, "Max. bucket count must be <= 512.");
+    // Radix distribution orders keys by their unsigned representation.
+    static_assert(!Cfg::kRadixSort
+                          || (detail::RadixKey<key_type>::kSupported
+                              && (std::is_same<key_less, std::less<>>::value
+                                  || std::is_same<key_less, std::less<key_type>>::value)),
+                  "Radix sort requires integer keys and std::less.");
+    // Number of buckets is limited by switch in classifier and by the block tags
+    static_assert(Cfg::kLogBuckets >= 1 && Cfg::kLogBuckets <= 12,
+                  "Bucket count must be between 2 and 4096.");
     // The implementation of the block alignment limits the possible block sizes.
     static_assert((kBlockSize & (kBlockSize - 1)) == 0,
                   "Block size must be a power of two.");
@@ -328,5 +494,11 @@ struct ExtendedConfig : public Cfg {
 #undef IPS4OML_MIN_PARALLEL_BLOCKS_PER_THREAD
 #undef IPS4OML_OVERSAMPLING_FACTOR_PERCENT
 #undef IPS4OML_UNROLL_CLASSIFIER
+#undef IPS4OML_SIMD_CLASSIFIER
+#undef IPS4OML_SIMD_BASE_CASE_SIZE
+#undef IPS4OML_MAX_NATURAL_RUNS
+#undef IPS4OML_SEED_POLICY
+#undef IPS4OML_SEED
+#undef IPS4OML_IMBALANCE_FACTOR_PERCENT
 
 }  // namespace ips4o
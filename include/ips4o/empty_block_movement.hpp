@@ -178,8 +178,11 @@ void Sorter<Cfg>::moveEmptyBlocks(const diff_t my_begin, const diff_t my_end,
             read_range_size -= elements_reserved;
             elements_reserved = 0;
 
-            // Move blocks
+            // Move blocks and their tags
             const auto size = std::min(read_range_size, write_ptr_end - write_ptr);
+            std::copy(block_tags_ + (read_ptr - size) / Cfg::kBlockSize,
+                      block_tags_ + read_ptr / Cfg::kBlockSize,
+                      block_tags_ + (write_ptr - begin_) / Cfg::kBlockSize);
             write_ptr = std::move(begin_ + read_ptr - size, begin_ + read_ptr, write_ptr);
         }
 
@@ -40,10 +40,14 @@
 #include <type_traits>
 
 #include "ips4o_fwd.hpp"
+#include "abbreviation.hpp"
 #include "base_case.hpp"
 #include "config.hpp"
 #include "memory.hpp"
+#include "memory_resource.hpp"
+#include "natural_runs.hpp"
 #include "parallel.hpp"
+#include "projection.hpp"
 #include "sequential.hpp"
 
 namespace ips4o {
@@ -52,8 +56,9 @@ namespace ips4o {
  * Helper function for creating a reusable sequential sorter.
  */
 template <class It, class Cfg = Config<>, class Comp = std::less<>>
-SequentialSorter<ExtendedConfig<It, Comp, Cfg>> make_sorter(Comp comp = Comp()) {
-  return SequentialSorter<ExtendedConfig<It, Comp, Cfg>>{true, std::move(comp)};
+SequentialSorter<ExtendedConfig<It, Comp, Cfg>> make_sorter(
+        Comp comp = Comp(), memory_resource* resource = get_default_resource()) {
+  return SequentialSorter<ExtendedConfig<It, Comp, Cfg>>{true, std::move(comp), resource};
 }
 
 /**
@@ -76,7 +81,8 @@ void sort(It begin, It end, Comp comp = Comp()) {
         return;
     }
 
-    if ((end - begin) <= Cfg::kBaseCaseMultiplier * Cfg::kBaseCaseSize) {
+    using ExtendedCfg = ips4o::ExtendedConfig<It, Comp, Cfg>;
+    if ((end - begin) <= Cfg::kBaseCaseMultiplier * ExtendedCfg::kBaseCaseSize) {
 #ifdef IPS4O_TIMER
         g_overhead.stop();
         g_base_case.start();
@@ -88,9 +94,8 @@ void sort(It begin, It end, Comp comp = Comp()) {
         g_base_case.stop();
         g_overhead.start();
 #endif
-    } else {
-        ips4o::SequentialSorter<ips4o::ExtendedConfig<It, Comp, Cfg>> sorter{
-                false, std::move(comp)};
+    } else if (!detail::sortNaturalRuns<ExtendedCfg>(begin, end, comp)) {
+        ips4o::SequentialSorter<ExtendedCfg> sorter{false, std::move(comp)};
         sorter(std::move(begin), std::move(end));
     }
 
@@ -100,6 +105,33 @@ void sort(It begin, It end, Comp comp = Comp()) {
 #endif
 }
 
+/**
+ * Returns the size of a workspace which lets the sort of n elements with the given
+ * number of threads run without allocating.
+ */
+template <class It, class Cfg = Config<>, class Comp = std::less<>>
+std::size_t workspace_size(std::ptrdiff_t n, int num_threads = 1) {
+    return detail::Sorter<ExtendedConfig<It, Comp, Cfg>>::workspaceSize(n, num_threads);
+}
+
+/**
+ * Sorts with memory from the workspace only and throws std::bad_alloc if it is too
+ * small. Natural runs are not merged, as that needs memory proportional to the input.
+ */
+template <class Cfg = Config<>, class It, class Comp>
+void sort(It begin, It end, Comp comp, workspace ws) {
+    if (detail::sortSimpleCases(begin, end, comp)) return;
+
+    using ExtendedCfg = ips4o::ExtendedConfig<It, Comp, Cfg>;
+    if ((end - begin) <= Cfg::kBaseCaseMultiplier * ExtendedCfg::kBaseCaseSize) {
+        detail::baseCaseSort(std::move(begin), std::move(end), std::move(comp));
+    } else {
+        arena_resource arena(ws.data, ws.size);
+        ips4o::SequentialSorter<ExtendedCfg> sorter{false, std::move(comp), &arena};
+        sorter(std::move(begin), std::move(end));
+    }
+}
+
 /**
  * Standard interface.
  */
@@ -113,7 +145,93 @@ void sort(It begin, It end) {
     ips4o::sort<Config<>>(std::move(begin), std::move(end), std::less<>());
 }
 
+/**
+ * Sorts by the keys obtained from a projection.
+ * Splitters store keys, and each element is projected once per classification.
+ */
+template <class Cfg, class It, class Comp, class Proj>
+void sort(It begin, It end, Comp comp, Proj proj) {
+    ips4o::sort<Cfg>(std::move(begin), std::move(end),
+                     detail::ProjectedLess<Comp, Proj>(std::move(comp), std::move(proj)));
+}
+
+template <class It, class Comp, class Proj>
+void sort(It begin, It end, Comp comp, Proj proj) {
+    ips4o::sort<Config<>>(std::move(begin), std::move(end), std::move(comp),
+                          std::move(proj));
+}
+
+/**
+ * Radix sort for integer keys.
+ * Distributes by key digits and falls back to sample sort on skewed digits.
+ */
+template <class Cfg = Config<>, class It>
+void radix_sort(It begin, It end) {
+    ips4o::sort<RadixConfig<Cfg>>(std::move(begin), std::move(end), std::less<>());
+}
+
+template <class Cfg = Config<>, class It, class Proj>
+void radix_sort(It begin, It end, Proj proj) {
+    ips4o::sort<RadixConfig<Cfg>>(std::move(begin), std::move(end), std::less<>(),
+                                  std::move(proj));
+}
+
+/**
+ * Sorts floats or doubles in IEEE-754 total order, -0.0 before +0.0.
+ * Values are classified by their order-preserving unsigned integer keys.
+ */
+template <class Cfg = Config<>, class It>
+void float_sort(It begin, It end, nan_policy nans = nan_policy::last) {
+    using T = typename std::iterator_traits<It>::value_type;
+    if (nans == nan_policy::last)
+        ips4o::radix_sort<Cfg>(std::move(begin), std::move(end),
+                               detail::FloatKey<T, nan_policy::last>());
+    else
+        ips4o::radix_sort<Cfg>(std::move(begin), std::move(end),
+                               detail::FloatKey<T, nan_policy::first>());
+}
+
 #if defined(_REENTRANT)
+namespace detail {
+
+/**
+ * Distinguishes thread pools from projections in the parallel interface.
+ */
+template <class T, class = void>
+struct IsThreadPool : std::false_type {};
+
+template <class T>
+struct IsThreadPool<T, decltype(std::declval<std::remove_reference_t<T>&>().numThreads(),
+                                void())> : std::true_type {};
+
+#if !defined(_OPENMP)
+/**
+ * Sorts with a pool leased from the process-wide pools. The sorters of empty
+ * comparators are kept with the pool, so that the next sorts neither start threads
+ * nor allocate thread-local data.
+ */
+template <class Cfg, class It, class Comp>
+void sortShared(It begin, It end, Comp comp, SharedThreadPools::Lease& lease) {
+    auto& thread_pool = lease.pool();
+    if (detail::sortSimpleCases(begin, end, comp, thread_pool)
+        || detail::sortNaturalRuns<ExtendedConfig<It, Comp, Cfg>>(
+                begin, end, comp, thread_pool, get_default_resource()))
+        return;
+
+    using Sorter = ParallelSorter<ExtendedConfig<It, Comp, Cfg, StdThreadPool&>>;
+    if (std::is_empty<Comp>::value) {
+        auto& sorter =
+                lease.state<Sorter>(get_default_resource(), comp, thread_pool, false);
+        sorter(std::move(begin), std::move(end));
+    } else {
+        Sorter sorter(std::move(comp), thread_pool, false);
+        sorter(std::move(begin), std::move(end));
+    }
+}
+#endif  // !_OPENMP
+
+}  // namespace detail
+
 namespace parallel {
 
 /**
@@ -122,24 +240,26 @@ namespace parallel {
 template <class It, class Cfg = Config<>, class ThreadPool, class Comp = std::less<>>
 std::enable_if_t<std::is_class<std::remove_reference_t<ThreadPool>>::value,
                  ParallelSorter<ExtendedConfig<It, Comp, Cfg, ThreadPool>>>
-make_sorter(ThreadPool&& thread_pool, Comp comp = Comp(), bool check_sorted = true) {
+make_sorter(ThreadPool&& thread_pool, Comp comp = Comp(), bool check_sorted = true,
+            memory_resource* resource = get_default_resource()) {
     return ParallelSorter<ExtendedConfig<It, Comp, Cfg, ThreadPool>>(
-            std::move(comp), std::forward<ThreadPool>(thread_pool), check_sorted);
+            std::move(comp), std::forward<ThreadPool>(thread_pool), check_sorted,
+            resource);
 }
 
 template <class It, class Cfg = Config<>, class Comp = std::less<>>
 ParallelSorter<ExtendedConfig<It, Comp, Cfg>> make_sorter(
         int num_threads = DefaultThreadPool::maxNumThreads(), Comp comp = Comp(),
-        bool check_sorted = true) {
+        bool check_sorted = true, memory_resource* resource = get_default_resource()) {
     return make_sorter<It, Cfg>(DefaultThreadPool(num_threads), std::move(comp),
-                                check_sorted);
+                                check_sorted, resource);
 }
 
 /**
  * Configurable interface.
  */
 template <class Cfg = Config<>, class It, class Comp, class ThreadPool>
-std::enable_if_t<std::is_class<std::remove_reference_t<ThreadPool>>::value> sort(
+std::enable_if_t<detail::IsThreadPool<ThreadPool>::value> sort(
         It begin, It end, Comp comp, ThreadPool&& thread_pool) {
 #ifdef IPS4O_TIMER
     g_active_counters = -1;
@@ -149,7 +269,9 @@ std::enable_if_t<std::is_class<std::remove_reference_t<ThreadPool>>::value> sort
 
     if (Cfg::numThreadsFor(begin, end, thread_pool.numThreads()) < 2) {
         ips4o::sort<Cfg>(std::move(begin), std::move(end), std::move(comp));
-    } else if (!detail::isSorted(begin, end, comp, thread_pool)) {
+    } else if (!detail::sortSimpleCases(begin, end, comp, thread_pool)
+               && !detail::sortNaturalRuns<ExtendedConfig<It, Comp, Cfg>>(
+                       begin, end, comp, thread_pool, get_default_resource())) {
         auto sorter = ips4o::parallel::make_sorter<It, Cfg>(
                 std::forward<ThreadPool>(thread_pool), std::move(comp), false);
         sorter(std::move(begin), std::move(end));
@@ -161,13 +283,79 @@ std::enable_if_t<std::is_class<std::remove_reference_t<ThreadPool>>::value> sort
 #endif
 }
 
+/**
+ * Sorts with memory from the workspace only and throws std::bad_alloc if it is too
+ * small. The thread pool and its scheduler may still allocate.
+ */
+template <class Cfg = Config<>, class It, class Comp, class ThreadPool>
+std::enable_if_t<detail::IsThreadPool<ThreadPool>::value> sort(
+        It begin, It end, Comp comp, ThreadPool&& thread_pool, workspace ws) {
+    if (Cfg::numThreadsFor(begin, end, thread_pool.numThreads()) < 2) {
+        ips4o::sort<Cfg>(std::move(begin), std::move(end), std::move(comp), ws);
+    } else if (!detail::sortSimpleCases(begin, end, comp, thread_pool)) {
+        arena_resource arena(ws.data, ws.size);
+        auto sorter = ips4o::parallel::make_sorter<It, Cfg>(
+                std::forward<ThreadPool>(thread_pool), std::move(comp), false, &arena);
+        sorter(std::move(begin), std::move(end));
+    }
+}
+
 template <class Cfg = Config<>, class It, class Comp>
 void sort(It begin, It end, Comp comp, int num_threads) {
     num_threads = Cfg::numThreadsFor(begin, end, num_threads);
+#if defined(_OPENMP)
     if (num_threads < 2)
         ips4o::sort<Cfg>(std::move(begin), std::move(end), std::move(comp));
     else
         ips4o::parallel::sort<Cfg>(begin, end, comp, DefaultThreadPool(num_threads));
+#else
+    // Threads are kept for the next sorts, concurrent sorts share them
+    auto lease = num_threads < 2 ? detail::SharedThreadPools::Lease()
+                                 : detail::SharedThreadPools::instance().acquire(num_threads);
+    if (lease)
+        detail::sortShared<Cfg>(std::move(begin), std::move(end), std::move(comp), lease);
+    else
+        ips4o::sort<Cfg>(std::move(begin), std::move(end), std::move(comp));
+#endif
+}
+
+/**
+ * Sorts by the keys obtained from a projection.
+ */
+template <class Cfg = Config<>, class It, class Comp, class Proj, class ThreadPool>
+std::enable_if_t<detail::IsThreadPool<ThreadPool>::value> sort(
+        It begin, It end, Comp comp, Proj proj, ThreadPool&& thread_pool) {
+    ips4o::parallel::sort<Cfg>(
+            std::move(begin), std::move(end),
+            detail::ProjectedLess<Comp, Proj>(std::move(comp), std::move(proj)),
+            std::forward<ThreadPool>(thread_pool));
+}
+
+template <class Cfg = Config<>, class It, class Comp, class Proj>
+void sort(It begin, It end, Comp comp, Proj proj, int num_threads) {
+    ips4o::parallel::sort<Cfg>(
+            std::move(begin), std::move(end),
+            detail::ProjectedLess<Comp, Proj>(std::move(comp), std::move(proj)),
+            num_threads);
+}
+
+/**
+ * Returns the size of a workspace which lets the sort of n elements with the given
+ * number of threads run without allocating.
+ */
+template <class It, class Cfg = Config<>, class Comp = std::less<>>
+std::size_t workspace_size(std::ptrdiff_t n,
+                           int num_threads = DefaultThreadPool::maxNumThreads()) {
+    return detail::Sorter<ExtendedConfig<It, Comp, Cfg>>::workspaceSize(n, num_threads);
+}
+
+/**
+ * Sorts with all threads and memory from the workspace only, see above.
+ */
+template <class Cfg = Config<>, class It, class Comp>
+void sort(It begin, It end, Comp comp, workspace ws) {
+    ips4o::parallel::sort<Cfg>(std::move(begin), std::move(end), std::move(comp),
+                               DefaultThreadPool(DefaultThreadPool::maxNumThreads()), ws);
 }
 
 /**
@@ -179,11 +367,52 @@ void sort(It begin, It end, Comp comp) {
                                     DefaultThreadPool::maxNumThreads());
 }
 
+template <class It, class Comp, class Proj>
+std::enable_if_t<!detail::IsThreadPool<Proj>::value && !std::is_integral<Proj>::value>
+sort(It begin, It end, Comp comp, Proj proj) {
+    ips4o::parallel::sort<Config<>>(std::move(begin), std::move(end), std::move(comp),
+                                    std::move(proj), DefaultThreadPool::maxNumThreads());
+}
+
 template <class It>
 void sort(It begin, It end) {
     ips4o::parallel::sort(std::move(begin), std::move(end), std::less<>());
 }
 
+/**
+ * Radix sort for integer keys.
+ */
+template <class Cfg = Config<>, class It>
+void radix_sort(It begin, It end, int num_threads = DefaultThreadPool::maxNumThreads()) {
+    ips4o::parallel::sort<RadixConfig<Cfg>>(std::move(begin), std::move(end),
+                                            std::less<>(), num_threads);
+}
+
+template <class Cfg = Config<>, class It, class Proj>
+std::enable_if_t<!std::is_integral<Proj>::value> radix_sort(
+        It begin, It end, Proj proj,
+        int num_threads = DefaultThreadPool::maxNumThreads()) {
+    ips4o::parallel::sort<RadixConfig<Cfg>>(std::move(begin), std::move(end),
+                                            std::less<>(), std::move(proj), num_threads);
+}
+
+/**
+ * Sorts floats or doubles in IEEE-754 total order, -0.0 before +0.0.
+ */
+template <class Cfg = Config<>, class It>
+void float_sort(It begin, It end, nan_policy nans = nan_policy::last,
+                int num_threads = DefaultThreadPool::maxNumThreads()) {
+    using T = typename std::iterator_traits<It>::value_type;
+    if (nans == nan_policy::last)
+        ips4o::parallel::radix_sort<Cfg>(std::move(begin), std::move(end),
+                                         detail::FloatKey<T, nan_policy::last>(),
+                                         num_threads);
+    else
+        ips4o::parallel::radix_sort<Cfg>(std::move(begin), std::move(end),
+                                         detail::FloatKey<T, nan_policy::first>(),
+                                         num_threads);
+}
+
 }  // namespace parallel
 #endif  // _REENTRANT
 }  // namespace ips4o
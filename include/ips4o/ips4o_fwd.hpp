@@ -35,8 +35,11 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iterator>
 #include <memory>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -61,6 +64,9 @@ inline void selectSample(It begin, It end,
                          typename std::iterator_traits<It>::difference_type num_samples,
                          RandomGen&& gen);
 
+template <class Cfg>
+class SplitterCache;
+
 template <class Cfg>
 class Sorter {
  public:
@@ -68,6 +74,8 @@ class Sorter {
     using diff_t = typename Cfg::difference_type;
     using value_type = typename Cfg::value_type;
     using SubThreadPool = typename Cfg::SubThreadPool;
+    // Bucket of a block flushed during local classification
+    using block_tag = std::uint16_t;
 
     class BufferStorage;
     class Block;
@@ -78,24 +86,27 @@ class Sorter {
     struct SharedData;
     explicit Sorter(LocalData& local) : local_(local) {}
 
+    static std::size_t workspaceSize(diff_t n, int num_threads);
+
+    static int maxLogBuckets(diff_t n, std::size_t budget, int num_threads);
+
+    static int bufferBuckets(int max_log_buckets);
+
     void sequential(iterator begin, iterator end);
 
-    void sequential(const iterator begin, const Task& task, PrivateQueue<Task>& queue);
+    void sequential(const iterator begin, const Task& task, WorkStealingDeque<Task>& queue);
 
     void sequential_rec(iterator begin, iterator end);
 
 #if defined(_REENTRANT)
     void parallelSortPrimary(iterator begin, iterator end, int num_threads,
-                             BufferStorage& buffer_storage,
-                             std::vector<std::shared_ptr<SubThreadPool>>& tp_trash);
+                             BufferStorage& buffer_storage);
 
     void parallelSortSecondary(iterator begin, iterator end, int id, int num_threads,
-                               BufferStorage& buffer_storage,
-                               std::vector<std::shared_ptr<SubThreadPool>>& tp_trash);
+                               BufferStorage& buffer_storage);
 
-    std::pair<std::vector<diff_t>, bool> parallelPartitionPrimary(iterator begin,
-                                                                  iterator end,
-                                                                  int num_threads);
+    std::pair<int, bool> parallelPartitionPrimary(iterator begin, iterator end,
+                                                  int num_threads, diff_t* bucket_start);
 
     void parallelPartitionSecondary(iterator begin, iterator end, int id,
                                     int num_threads);
@@ -110,6 +121,7 @@ class Sorter {
 
     diff_t* bucket_start_;
     BucketPointers* bucket_pointers_;
+    block_tag* block_tags_;
     Block* overflow_;
 
     iterator begin_;
@@ -120,9 +132,53 @@ class Sorter {
 
     static inline int computeLogBuckets(diff_t n);
 
+    static inline std::tuple<int, diff_t, diff_t> sampleParameters(diff_t n,
+                                                                    int max_log_buckets);
+
     std::pair<int, bool> buildClassifier(iterator begin, iterator end,
                                          Classifier& classifier);
 
+    std::pair<int, bool> buildClassifier(const SplitterCache<Cfg>& cache,
+                                         Classifier& classifier);
+
+    void splitSample(diff_t sample_begin, int num_buckets, bool equal_buckets,
+                     Classifier& classifier, diff_t* sample_start);
+
+    template <class SampleIt, class Key>
+    std::pair<int, bool> buildClassifierFromSample(SampleIt sample_begin,
+                                                   SampleIt sample_end, int log_buckets,
+                                                   diff_t step, Key&& key,
+                                                   Classifier& classifier);
+
+    void parallelSample(iterator begin, iterator end, diff_t num_samples, int my_id,
+                        int num_threads);
+
+    inline bool checkSorted(iterator begin, iterator end, int my_id, int num_threads);
+
+    template <bool kIsParallel>
+    std::uint64_t radixDifference(iterator begin, iterator end, int my_id,
+                                  int num_threads);
+
+    template <bool kIsParallel>
+    std::uint64_t radixDifference(iterator begin, iterator end, int my_id,
+                                  int num_threads, std::true_type);
+
+    template <bool kIsParallel>
+    std::uint64_t radixDifference(iterator begin, iterator end, int my_id,
+                                  int num_threads, std::false_type);
+
+    std::pair<int, bool> buildRadixClassifier(iterator begin, iterator end,
+                                              std::uint64_t diff, Classifier& classifier);
+
+    int radixClassifier(iterator begin, iterator end, std::uint64_t diff,
+                        Classifier& classifier);
+
+    int radixClassifier(iterator begin, iterator end, std::uint64_t diff,
+                        Classifier& classifier, std::true_type);
+
+    int radixClassifier(iterator begin, iterator end, std::uint64_t diff,
+                        Classifier& classifier, std::false_type);
+
     template <bool kEqualBuckets>
     __attribute__((flatten)) diff_t classifyLocally(iterator my_begin, iterator my_end);
 
@@ -149,19 +205,21 @@ class Sorter {
     void writeMargins(int first_bucket, int last_bucket, int overflow_bucket,
                       int swap_bucket, diff_t in_swap_buffer);
 
+    static inline std::pair<int, std::uint64_t> largestBucket(const diff_t* bucket_start,
+                                                              int num_buckets,
+                                                              bool equal_buckets);
+
     template <bool kIsParallel>
     std::pair<int, bool> partition(iterator begin, iterator end, diff_t* bucket_start,
                                    int my_id, int num_threads);
 
-    void processSmallTasks(iterator begin);
+    void processSmallTasks(iterator begin, int id);
 
     void processBigTasks(const iterator begin, const diff_t stripe, const int my_id,
-                         BufferStorage& buffer_storage,
-                         std::vector<std::shared_ptr<SubThreadPool>>& tp_trash);
+                         BufferStorage& buffer_storage);
 
     void processBigTaskPrimary(const iterator begin, const diff_t stripe, const int my_id,
-                               BufferStorage& buffer_storage,
-                               std::vector<std::shared_ptr<SubThreadPool>>& tp_trash);
+                               BufferStorage& buffer_storage);
     void processBigTasksSecondary(const int my_id);
 
     void queueTasks(const diff_t stripe, const int id, const int num_threads,
@@ -35,6 +35,8 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "ips4o_fwd.hpp"
 #include "classifier.hpp"
 #include "empty_block_movement.hpp"
@@ -43,6 +45,36 @@
 namespace ips4o {
 namespace detail {
 
+/**
+ * Checks in parallel whether the range is sorted. Must run before sampling, which
+ * moves elements. A thread stops checking its stripe at the first inversion or as
+ * soon as another thread has found one, so unsorted ranges cost only a few
+ * comparisons and a barrier.
+ */
+template <class Cfg>
+bool Sorter<Cfg>::checkSorted(const iterator begin, const iterator end, const int my_id,
+                              const int num_threads) {
+    constexpr diff_t kChunkSize = 4 * Cfg::kBlockSize;
+    const auto& comp = shared_->classifier.getComparator();
+    const auto n = end - begin;
+    auto it = begin + n * my_id / num_threads;
+    // Include the first element of the next stripe to check the boundary
+    const auto my_end = begin + std::min(n * (my_id + 1) / num_threads + 1, n);
+
+    while (my_end - it > 1 && !__atomic_load_n(&shared_->is_unsorted, __ATOMIC_RELAXED)) {
+        const auto chunk_end = it + std::min(kChunkSize, diff_t(my_end - it));
+        const auto inversion = std::is_sorted_until(it, chunk_end, comp);
+        if (inversion != chunk_end) {
+            __atomic_store_n(&shared_->is_unsorted, true, __ATOMIC_RELAXED);
+            break;
+        }
+        it = chunk_end - 1;
+    }
+
+    shared_->sync.barrier();
+    return !__atomic_load_n(&shared_->is_unsorted, __ATOMIC_RELAXED);
+}
+
 /**
  * Local classification phase.
  */
@@ -58,6 +90,8 @@ typename Cfg::difference_type Sorter<Cfg>::classifyLocally(const iterator my_beg
             my_begin, my_end, [&](typename Cfg::bucket_type bucket, iterator it) {
                 // Only flush buffers on overflow
                 if (buffers.isFull(bucket)) {
+                    block_tags_[(write - begin_) / Cfg::kBlockSize] =
+                            static_cast<block_tag>(bucket);
                     buffers.writeTo(bucket, write);
                     write += Cfg::kBlockSize;
                     local_.bucket_size[bucket] += Cfg::kBlockSize;
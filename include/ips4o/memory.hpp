@@ -40,37 +40,27 @@
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <random>
+#include <tuple>
 #include <utility>
 #include <vector>
 
-#if !defined(IPS4O_SEQUENTIAL)
-#include <tbb/concurrent_queue.h>
-#endif
-
 #include "ips4o_fwd.hpp"
 #include "bucket_pointers.hpp"
 #include "buffers.hpp"
 #include "classifier.hpp"
 #include "config.hpp"
+#include "memory_resource.hpp"
 #include "scheduler.hpp"
+#include "splitter_cache.hpp"
 
 namespace ips4o {
 namespace detail {
 
 /**
- * Aligns a pointer.
- */
-template <class T>
-static T* alignPointer(T* ptr, std::size_t alignment) {
-    uintptr_t v = reinterpret_cast<std::uintptr_t>(ptr);
-    v = (v - 1 + alignment) & ~(alignment - 1);
-    return reinterpret_cast<T*>(v);
-}
-
-/**
- * Constructs an object at the specified alignment.
+ * Constructs an object at the specified alignment in memory from a resource.
  */
 template <class T>
 class AlignedPtr {
@@ -78,71 +68,93 @@ class AlignedPtr {
     AlignedPtr() {}
 
     template <class... Args>
-    explicit AlignedPtr(std::size_t alignment, Args&&... args)
-        : alloc_(new char[sizeof(T) + alignment])
-        , value_(new (alignPointer(alloc_, alignment)) T(std::forward<Args>(args)...)) {}
+    explicit AlignedPtr(memory_resource* resource, std::size_t alignment, Args&&... args)
+        : resource_(resource)
+        , alignment_(alignment)
+        , value_(static_cast<T*>(resource->allocate(sizeof(T), alignment))) {
+        try {
+            new (value_) T(std::forward<Args>(args)...);
+        } catch (...) {
+            resource_->deallocate(value_, sizeof(T), alignment_);
+            throw;
+        }
+    }
 
     AlignedPtr(const AlignedPtr&) = delete;
     AlignedPtr& operator=(const AlignedPtr&) = delete;
 
-    AlignedPtr(AlignedPtr&& rhs) : alloc_(rhs.alloc_), value_(rhs.value_) {
-        rhs.alloc_ = nullptr;
+    AlignedPtr(AlignedPtr&& rhs)
+        : resource_(rhs.resource_), alignment_(rhs.alignment_), value_(rhs.value_) {
+        rhs.resource_ = nullptr;
     }
     AlignedPtr& operator=(AlignedPtr&& rhs) {
-        std::swap(alloc_, rhs.alloc_);
+        std::swap(resource_, rhs.resource_);
+        std::swap(alignment_, rhs.alignment_);
         std::swap(value_, rhs.value_);
         return *this;
     }
 
     ~AlignedPtr() {
-        if (alloc_) {
+        if (resource_) {
             value_->~T();
-            delete[] alloc_;
+            resource_->deallocate(value_, sizeof(T), alignment_);
         }
     }
 
     T& get() { return *value_; }
 
  private:
-    char* alloc_ = nullptr;
-    T* value_;
+    memory_resource* resource_ = nullptr;
+    std::size_t alignment_ = 0;
+    T* value_ = nullptr;
 };
 
 /**
- * Provides aligned storage without constructing an object.
+ * Provides aligned storage from a resource without constructing an object.
  */
 template <>
 class AlignedPtr<void> {
  public:
     AlignedPtr() {}
 
-    template <class... Args>
-    explicit AlignedPtr(std::size_t alignment, std::size_t size)
-        : alloc_(new char[size + alignment]), value_(alignPointer(alloc_, alignment)) {}
+    explicit AlignedPtr(memory_resource* resource, std::size_t alignment,
+                        std::size_t size)
+        : resource_(resource)
+        , alignment_(alignment)
+        , size_(size)
+        , value_(static_cast<char*>(resource->allocate(size, alignment))) {}
 
     AlignedPtr(const AlignedPtr&) = delete;
     AlignedPtr& operator=(const AlignedPtr&) = delete;
 
-    AlignedPtr(AlignedPtr&& rhs) : alloc_(rhs.alloc_), value_(rhs.value_) {
-        rhs.alloc_ = nullptr;
+    AlignedPtr(AlignedPtr&& rhs)
+        : resource_(rhs.resource_)
+        , alignment_(rhs.alignment_)
+        , size_(rhs.size_)
+        , value_(rhs.value_) {
+        rhs.resource_ = nullptr;
     }
     AlignedPtr& operator=(AlignedPtr&& rhs) {
-        std::swap(alloc_, rhs.alloc_);
+        std::swap(resource_, rhs.resource_);
+        std::swap(alignment_, rhs.alignment_);
+        std::swap(size_, rhs.size_);
         std::swap(value_, rhs.value_);
         return *this;
     }
 
     ~AlignedPtr() {
-        if (alloc_) {
-            delete[] alloc_;
+        if (resource_) {
+            resource_->deallocate(value_, size_, alignment_);
         }
     }
 
     char* get() { return value_; }
 
  private:
-    char* alloc_ = nullptr;
-    char* value_;
+    memory_resource* resource_ = nullptr;
+    std::size_t alignment_ = 0;
+    std::size_t size_ = 0;
+    char* value_ = nullptr;
 };
 
 /**
@@ -151,15 +163,108 @@ class AlignedPtr<void> {
 template <class Cfg>
 class Sorter<Cfg>::BufferStorage : public AlignedPtr<void> {
  public:
-    static constexpr const auto kPerThread =
-            Cfg::kBlockSizeInBytes * Cfg::kMaxBuckets * (1 + Cfg::kAllowEqualBuckets);
+    static constexpr const std::size_t kPerThread =
+            (sizeof(Block) * Cfg::kMaxBuckets + Cfg::kDataAlignment - 1)
+            & ~(Cfg::kDataAlignment - 1);
+
+    /**
+     * Bytes of the buffers of one thread for the given number of buckets.
+     */
+    static std::size_t bytesPerThread(const int num_buckets) {
+        return (sizeof(Block) * num_buckets + Cfg::kDataAlignment - 1)
+               & ~(Cfg::kDataAlignment - 1);
+    }
 
     BufferStorage() {}
 
-    explicit BufferStorage(int num_threads)
-        : AlignedPtr<void>(Cfg::kDataAlignment, num_threads * kPerThread) {}
+    BufferStorage(int num_threads, memory_resource* resource,
+                  int num_buckets = Cfg::kMaxBuckets)
+        : AlignedPtr<void>(resource, Cfg::kDataAlignment,
+                           num_threads * bytesPerThread(num_buckets))
+        , num_threads_(num_threads)
+        , num_buckets_(num_buckets) {}
+
+    char* forThread(int id) { return this->get() + id * bytesPerThread(num_buckets_); }
+
+    int numThreads() const { return num_threads_; }
 
-    char* forThread(int id) { return this->get() + id * kPerThread; }
+    int numBuckets() const { return num_buckets_; }
+
+    std::size_t bytes() const { return num_threads_ * bytesPerThread(num_buckets_); }
+
+ private:
+    int num_threads_ = 0;
+    int num_buckets_ = 0;
+};
+
+/**
+ * Logarithm of the number of buckets, besides the equality buckets, which the
+ * partitioning steps of a sort of n elements may use. Smaller inputs need fewer
+ * buckets and thus smaller buffers. Lower levels may use one more bucket level than
+ * the top level, as the buckets of the last two levels are split evenly. The buffers
+ * of all threads stay within the budget if it allows two buckets at all. A budget of
+ * zero means no limit.
+ */
+template <class Cfg>
+int Sorter<Cfg>::maxLogBuckets(const diff_t n, const std::size_t budget,
+                               const int num_threads) {
+    int log_buckets = Cfg::logBuckets(n);
+    if (n > Cfg::kSingleLevelThreshold)
+        log_buckets = Cfg::kRadixSort || log_buckets == Cfg::kLogBuckets
+                              ? Cfg::kLogBuckets
+                              : log_buckets + 1;
+
+    const auto bytes = [num_threads](const int bits) {
+        return num_threads * BufferStorage::bytesPerThread(bufferBuckets(bits));
+    };
+    if (budget != 0)
+        while (log_buckets > 1 && bytes(log_buckets) > budget) --log_buckets;
+    return log_buckets;
+}
+
+/**
+ * Number of bucket buffers used with at most 2^max_log_buckets buckets besides the
+ * equality buckets.
+ */
+template <class Cfg>
+int Sorter<Cfg>::bufferBuckets(const int max_log_buckets) {
+    return 1 << (max_log_buckets + Cfg::kAllowEqualBuckets);
+}
+
+/**
+ * Owns the thread pools for the big tasks of a sort. A task takes a pool which all
+ * threads of its previous task have left, so that pools are only allocated while
+ * the number of pools in use grows.
+ */
+template <class Pool>
+class SubThreadPoolCache {
+ public:
+    SubThreadPoolCache(int num_threads, memory_resource* resource)
+        : max_tasks_(num_threads / 2), resource_(resource), pools_(resource) {}
+
+    /**
+     * Returns an idle pool for a task with the given number of threads.
+     */
+    Pool& acquire(const int num_threads) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& pool : pools_) {
+            if (pool.get().idle()) {
+                pool.get().reset(num_threads);
+                return pool.get();
+            }
+        }
+
+        // Each big task has at least two threads
+        if (pools_.empty()) pools_.reserve(max_tasks_);
+        pools_.emplace_back(resource_, alignof(Pool), num_threads);
+        return pools_.back().get();
+    }
+
+ private:
+    const int max_tasks_;
+    memory_resource* const resource_;
+    std::mutex mutex_;
+    Vector<AlignedPtr<Pool>> pools_;
 };
 
 /**
@@ -174,14 +279,36 @@ struct Sorter<Cfg>::LocalData {
     Block swap[2];
     Block overflow;
 
-    PrivateQueue<Task> seq_task_queue;
+    WorkStealingDeque<Task> seq_task_queue;
 
     // Bucket information
     BucketPointers bucket_pointers[Cfg::kMaxBuckets];
+    Vector<block_tag> block_tags;
 
     // Classifier
     Classifier classifier;
 
+    // Part of the sample drawn by this thread in parallel partitioning steps
+    Vector<typename Cfg::key_type> sample;
+
+    // Sorted samples of the enclosing sequential partitioning steps, innermost last
+    Vector<typename Cfg::key_type> sample_stack;
+    // Part of the sample stack drawn from the range of the next partitioning step
+    diff_t inherited_begin = 0;
+    diff_t inherited_end = 0;
+    // Receives the start of each bucket in the sample of the next partitioning step,
+    // which is then kept on the sample stack. Cleared when used.
+    diff_t* sample_start = nullptr;
+
+    // Logarithm of the number of buckets the buffers of this thread can hold
+    int max_log_buckets = Cfg::kLogBuckets;
+
+    // Splitters to use for the next partitioning step, cleared when used
+    SplitterCache<Cfg>* splitter_cache = nullptr;
+
+    // Statistics of the sorter running on this thread, if any
+    partition_statistics* statistics = nullptr;
+
     // Information used during empty block movement
     diff_t first_block;
     diff_t first_empty_block;
@@ -193,12 +320,15 @@ struct Sorter<Cfg>::LocalData {
             Cfg::kIs64Bit ? 1442695040888963407u : 1013904223u, 0u>
             random_generator;
 
-    LocalData(typename Cfg::less comp, char* buffer_storage)
-        : buffers(buffer_storage), classifier(std::move(comp)) {
-        std::random_device rdev;
-        std::ptrdiff_t seed = rdev();
-        if (Cfg::kIs64Bit) seed = (seed << (Cfg::kIs64Bit * 32)) | rdev();
-        random_generator.seed(seed);
+    LocalData(typename Cfg::less comp, char* buffer_storage, int thread_id,
+              memory_resource* resource)
+        : buffers(buffer_storage)
+        , seq_task_queue(resource)
+        , block_tags(resource)
+        , classifier(std::move(comp))
+        , sample(resource)
+        , sample_stack(resource) {
+        random_generator.seed(static_cast<std::uintptr_t>(Cfg::seedFor(thread_id)));
         reset();
     }
 
@@ -235,34 +365,57 @@ struct Sorter<Cfg>::SharedData {
     // Bucket information
     typename Cfg::difference_type bucket_start[Cfg::kMaxBuckets + 1];
     BucketPointers bucket_pointers[Cfg::kMaxBuckets];
+    Vector<block_tag> block_tags;
     Block* overflow;
     int num_buckets;
     bool use_equal_buckets;
 
+    // Set as soon as a thread finds an inversion in its stripe
+    bool is_unsorted;
+
+    // Bits in which the keys differ, for radix sorters
+    std::uint64_t radix_difference;
+
     // Classifier for parallel partitioning
     Classifier classifier;
 
+    // Splitters to use for the top-level partitioning step
+    SplitterCache<Cfg>* splitter_cache = nullptr;
+
+    // Statistics of the sorter running this step, if any
+    partition_statistics* statistics = nullptr;
+
+    // Source of the data of big tasks
+    memory_resource* resource;
+
     // Synchronisation support
     typename Cfg::Sync sync;
 
     // Local thread data
-    std::vector<LocalData*> local;
+    Vector<LocalData*> local;
 
     // Thread pools for bigtasks. One entry for each thread.
-    std::vector<std::shared_ptr<SubThreadPool>> thread_pools;
+    Vector<SubThreadPool*> thread_pools;
+
+    // Owner of the thread pools for bigtasks
+    SubThreadPoolCache<SubThreadPool> sub_thread_pools;
 
     // Bigtasks. One entry per thread.
-    std::vector<BigTask> big_tasks;
+    Vector<BigTask> big_tasks;
 
     // Scheduler of small tasks.
     Scheduler<Task> scheduler;
 
-    SharedData(typename Cfg::less comp, typename Cfg::Sync sync, int num_threads)
-        : classifier(std::move(comp))
+    SharedData(typename Cfg::less comp, typename Cfg::Sync sync, int num_threads,
+               memory_resource* resource)
+        : block_tags(resource)
+        , classifier(std::move(comp))
+        , resource(resource)
         , sync(std::forward<typename Cfg::Sync>(sync))
-        , local(num_threads)
-        , thread_pools(num_threads)
-        , big_tasks(num_threads)
+        , local(num_threads, resource)
+        , thread_pools(num_threads, resource)
+        , sub_thread_pools(num_threads, resource)
+        , big_tasks(num_threads, resource)
         , scheduler(num_threads)
     {
         reset();
@@ -275,9 +428,74 @@ struct Sorter<Cfg>::SharedData {
         classifier.reset();
         std::fill_n(bucket_start, Cfg::kMaxBuckets + 1, 0);
         overflow = nullptr;
+        is_unsorted = false;
+        radix_difference = 0;
         scheduler.reset();
     }
 };
 
+/**
+ * Upper bound of the memory which a sorter with the given number of threads draws
+ * from its resource while sorting n elements. Vectors may hold twice the capacity
+ * they need and keep their old storage while they grow. The result is doubled as
+ * the free memory of an arena may be fragmented.
+ */
+template <class Cfg>
+std::size_t Sorter<Cfg>::workspaceSize(const diff_t n, const int num_threads) {
+    const std::size_t threads = std::max(num_threads, 1);
+    const std::size_t levels = detail::log2(std::max<diff_t>(n, 2)) + 1;
+    const std::size_t samples =
+            std::get<2>(sampleParameters(std::max<diff_t>(n, 2), Cfg::kLogBuckets));
+    const std::size_t buffers = BufferStorage::bytesPerThread(
+            bufferBuckets(maxLogBuckets(n, 0, num_threads)));
+    const std::size_t blocks = n / Cfg::kBlockSize + 1;
+    const std::size_t growth = 3;
+    // Bookkeeping and alignment of each allocation
+    const std::size_t overhead = Cfg::kDataAlignment + 32;
+    const std::size_t key_size = sizeof(typename Cfg::key_type);
+    // Task deques start with a page and double, keeping the arrays they replace
+    const std::size_t queue_size = 2 * 4096 + 8 * overhead;
+
+    // Buffers and local data of a sequential sorter, which holds the block tags of
+    // the whole input and one sample per recursion level
+    std::size_t size = buffers + sizeof(LocalData)
+                       + growth * blocks * sizeof(block_tag)
+                       + growth * levels * samples * key_size + 8 * overhead;
+
+#if defined(_REENTRANT)
+    if (threads > 1) {
+        using BigTaskSorter =
+                Sorter<ExtendedConfig<iterator, typename Cfg::less,
+                                      typename Cfg::BaseConfig, SubThreadPool>>;
+        const std::size_t per_task =
+                sizeof(LocalData*) + sizeof(BigTask) + sizeof(SubThreadPool*);
+
+        // Shared data of the top level and of the big tasks running at the same time
+        size += sizeof(SharedData) + 2 * growth * blocks * sizeof(block_tag)
+                + threads * (sizeof(typename BigTaskSorter::SharedData)
+                             + threads * per_task + 4 * overhead)
+                + threads * threads * per_task;
+
+        // Thread pools of big tasks. A pool is reused as soon as all threads have
+        // left it, and each thread is in at most one pool.
+        size += 2 * threads
+                * (sizeof(SubThreadPool) + growth * sizeof(AlignedPtr<SubThreadPool>)
+                   + overhead);
+
+        // Local data of each thread at the top level and in big tasks. Small tasks
+        // cover at most two stripes and are queued up to one level at a time.
+        size += threads
+                * (buffers + sizeof(LocalData)
+                   + sizeof(typename BigTaskSorter::LocalData) + 2 * queue_size
+                   + 4 * levels * Cfg::kMaxBuckets * sizeof(Task)
+                   + growth * (2 * blocks / threads + 1) * sizeof(block_tag)
+                   + growth * (levels + 2) * samples * key_size
+                   + sizeof(detail::AlignedPtr<LocalData>) + 16 * overhead);
+    }
+#endif
+
+    return 2 * size;
+}
+
 }  // namespace detail
 }  // namespace ips4o
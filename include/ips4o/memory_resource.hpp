@@ -0,0 +1,389 @@
+/******************************************************************************
+ * include/ips4o/memory_resource.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ips4o {
+
+/**
+ * Source of the buffers and of the shared and thread-local data of the sorters.
+ * Mirrors std::pmr::memory_resource, which is not available before C++17.
+ */
+class memory_resource {
+ public:
+    virtual ~memory_resource() = default;
+
+    void* allocate(std::size_t bytes, std::size_t alignment) {
+        return do_allocate(bytes, alignment);
+    }
+
+    void deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+        do_deallocate(p, bytes, alignment);
+    }
+
+ protected:
+    virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+    virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+};
+
+namespace detail {
+
+/**
+ * Allocates from the heap.
+ */
+class HeapResource : public memory_resource {
+ protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* p = nullptr;
+        if (posix_memalign(&p, std::max(alignment, sizeof(void*)), bytes) != 0)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t, std::size_t) override { std::free(p); }
+};
+
+}  // namespace detail
+
+/**
+ * The resource which allocates from the heap.
+ */
+inline memory_resource* new_delete_resource() {
+    static detail::HeapResource resource;
+    return &resource;
+}
+
+namespace detail {
+
+inline std::atomic<memory_resource*>& defaultResource() {
+    static std::atomic<memory_resource*> resource{new_delete_resource()};
+    return resource;
+}
+
+}  // namespace detail
+
+/**
+ * The resource used by sorters which are not given one, initially the heap.
+ */
+inline memory_resource* get_default_resource() {
+    return detail::defaultResource().load(std::memory_order_acquire);
+}
+
+/**
+ * Sets the default resource and returns the previous one. Passing nullptr restores
+ * the heap.
+ */
+inline memory_resource* set_default_resource(memory_resource* resource) {
+    return detail::defaultResource().exchange(
+            resource ? resource : new_delete_resource(), std::memory_order_acq_rel);
+}
+
+namespace detail {
+
+/**
+ * Allocator of standard containers which draws from a resource, like
+ * std::pmr::polymorphic_allocator.
+ */
+template <class T>
+class ResourceAllocator {
+ public:
+    using value_type = T;
+
+    ResourceAllocator(memory_resource* resource = get_default_resource()) noexcept
+        : resource_(resource) {}
+
+    template <class U>
+    ResourceAllocator(const ResourceAllocator<U>& other) noexcept
+        : resource_(other.resource()) {}
+
+    T* allocate(std::size_t n) {
+        if (n > ~std::size_t{0} / sizeof(T)) throw std::bad_alloc();
+        return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    memory_resource* resource() const noexcept { return resource_; }
+
+ private:
+    memory_resource* resource_;
+};
+
+template <class T, class U>
+bool operator==(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+    return lhs.resource() == rhs.resource();
+}
+
+template <class T, class U>
+bool operator!=(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+    return !(lhs == rhs);
+}
+
+template <class T>
+using Vector = std::vector<T, ResourceAllocator<T>>;
+
+}  // namespace detail
+
+/**
+ * Hands out memory from a caller-supplied buffer and throws std::bad_alloc when it is
+ * exhausted. Returned memory is reused by later allocations: free ranges are kept in
+ * an address-ordered list, merged with their neighbours and searched first fit.
+ */
+class arena_resource : public memory_resource {
+ public:
+    arena_resource(void* buffer, std::size_t size) {
+        const auto address = reinterpret_cast<std::uintptr_t>(buffer);
+        const std::size_t padding = (kGranule - address % kGranule) % kGranule;
+        if (size >= padding + sizeof(FreeRange)) {
+            free_ = reinterpret_cast<FreeRange*>(static_cast<char*>(buffer) + padding);
+            free_->size = (size - padding) & ~(kGranule - 1);
+            free_->next = nullptr;
+        }
+    }
+
+    /**
+     * Largest number of bytes in use at the same time so far, including the
+     * bookkeeping of each allocation.
+     */
+    std::size_t peak() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peak_;
+    }
+
+ protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (alignment < kGranule) alignment = kGranule;
+        if (bytes > ~std::size_t{0} / 2) throw std::bad_alloc();
+        const std::size_t max_size =
+                roundUp(sizeof(Header) + alignment - kGranule + bytes);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (FreeRange** link = &free_; *link; link = &(*link)->next) {
+            FreeRange* const range = *link;
+            if (range->size < max_size) continue;
+
+            // The header precedes the aligned memory, the rest of the range stays free
+            char* const start = reinterpret_cast<char*>(range);
+            const auto address = reinterpret_cast<std::uintptr_t>(start + sizeof(Header));
+            char* const p = start + sizeof(Header)
+                            + (alignment - address % alignment) % alignment;
+            std::size_t size = roundUp(p + bytes - start);
+            if (range->size - size < sizeof(FreeRange)) {
+                size = range->size;
+                *link = range->next;
+            } else {
+                auto* const rest = reinterpret_cast<FreeRange*>(start + size);
+                rest->size = range->size - size;
+                rest->next = range->next;
+                *link = rest;
+            }
+
+            auto* const header = reinterpret_cast<Header*>(p) - 1;
+            header->start = start;
+            header->size = size;
+            used_ += size;
+            peak_ = std::max(peak_, used_);
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+
+    void do_deallocate(void* p, std::size_t, std::size_t) override {
+        const auto* const header = static_cast<Header*>(p) - 1;
+        auto* const range = reinterpret_cast<FreeRange*>(header->start);
+        range->size = header->size;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= range->size;
+
+        FreeRange* prev = nullptr;
+        FreeRange* next = free_;
+        while (next && next < range) {
+            prev = next;
+            next = next->next;
+        }
+
+        range->next = next;
+        if (next && end(range) == reinterpret_cast<char*>(next)) {
+            range->size += next->size;
+            range->next = next->next;
+        }
+        if (prev && end(prev) == reinterpret_cast<char*>(range)) {
+            prev->size += range->size;
+            prev->next = range->next;
+        } else if (prev) {
+            prev->next = range;
+        } else {
+            free_ = range;
+        }
+    }
+
+ private:
+    static constexpr std::size_t kGranule = 16;
+
+    struct alignas(kGranule) Header {
+        char* start;
+        std::size_t size;
+    };
+
+    struct FreeRange {
+        std::size_t size;
+        FreeRange* next;
+    };
+
+    static std::size_t roundUp(std::size_t size) {
+        return (size + kGranule - 1) & ~(kGranule - 1);
+    }
+
+    static char* end(FreeRange* range) {
+        return reinterpret_cast<char*>(range) + range->size;
+    }
+
+    mutable std::mutex mutex_;
+    FreeRange* free_ = nullptr;
+    std::size_t used_ = 0;
+    std::size_t peak_ = 0;
+};
+
+/**
+ * Caller-supplied memory for a single sort. See workspace_size().
+ */
+struct workspace {
+    void* data;
+    std::size_t size;
+};
+
+#if defined(__linux__)
+
+/**
+ * Allocates huge pages with mmap. If no huge pages are reserved, the allocation falls
+ * back to regular pages and asks for transparent huge pages instead.
+ * Each allocation occupies whole huge pages.
+ */
+class huge_page_resource : public memory_resource {
+ public:
+    /**
+     * Uses 1 GiB pages if gigantic is set, 2 MiB pages otherwise.
+     */
+    explicit huge_page_resource(bool gigantic = false)
+        : page_size_(gigantic ? std::size_t{1} << 30 : std::size_t{1} << 21)
+        , page_flag_(gigantic ? 30 << MAP_HUGE_SHIFT : 21 << MAP_HUGE_SHIFT) {}
+
+ protected:
+    void* do_allocate(std::size_t bytes, std::size_t) override {
+        const auto size = roundUp(bytes);
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag_, -1, 0);
+        if (p == MAP_FAILED) {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t) override {
+        munmap(p, roundUp(bytes));
+    }
+
+ private:
+    std::size_t roundUp(std::size_t bytes) const {
+        return (bytes + page_size_ - 1) & ~(page_size_ - 1);
+    }
+
+    const std::size_t page_size_;
+    const int page_flag_;
+};
+
+/**
+ * Allocates pages bound to one NUMA node. The memory stays unbound if the kernel
+ * rejects the binding, e.g., without NUMA support.
+ */
+class numa_resource : public memory_resource {
+ public:
+    explicit numa_resource(int node) : node_(node) {}
+
+ protected:
+    void* do_allocate(std::size_t bytes, std::size_t) override {
+        const auto size = roundUp(bytes);
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+
+        // Bind before the pages are touched, so that they are placed on the node
+        constexpr const int kBits = 8 * sizeof(unsigned long);
+        constexpr const int kBind = 2;  // MPOL_BIND
+        unsigned long mask[1024 / kBits] = {};
+        if (node_ >= 0 && node_ < 1024) {
+            mask[node_ / kBits] = 1ul << (node_ % kBits);
+            syscall(SYS_mbind, p, size, kBind, mask, 1024, 0);
+        }
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t) override {
+        munmap(p, roundUp(bytes));
+    }
+
+ private:
+    static std::size_t roundUp(std::size_t bytes) {
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        return (bytes + page - 1) & ~(page - 1);
+    }
+
+    const int node_;
+};
+
+#endif  // __linux__
+
+}  // namespace ips4o
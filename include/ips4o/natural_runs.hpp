@@ -0,0 +1,397 @@
+/******************************************************************************
+ * include/ips4o/natural_runs.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+
+#include "ips4o_fwd.hpp"
+#include "memory.hpp"
+#include "memory_resource.hpp"
+
+namespace ips4o {
+namespace detail {
+
+/**
+ * Sorts inputs that consist of few natural runs by merging the runs.
+ *
+ * Runs are non-descending or strictly descending; descending runs are reversed.
+ * Adjacent runs are merged pairwise in rounds. Only the overlap of two runs is
+ * merged: the elements of the left run greater than the head of the right run and
+ * the elements of the right run less than the tail of the left run. Each round
+ * merges all overlaps into a scratch buffer and moves them back, both in parallel
+ * if a thread pool is given. Thus, a sorted input with a few misplaced elements
+ * costs little more than one scan.
+ */
+template <class Cfg>
+class NaturalRuns {
+    using iterator = typename Cfg::iterator;
+    using diff_t = typename Cfg::difference_type;
+    using value_type = typename Cfg::value_type;
+    using less = typename Cfg::less;
+
+    /**
+     * The overlap [begin, end) of two adjacent runs, split at mid.
+     */
+    struct Overlap {
+        diff_t begin;
+        diff_t mid;
+        diff_t end;
+        diff_t offset;
+    };
+
+ public:
+    /**
+     * Maximum number of merged elements, relative to the input size.
+     * Merging the input twice is still cheaper than sample sorting it.
+     */
+    static constexpr const diff_t kMergeBudget = 2;
+
+    /**
+     * Maximum number of runs of an input of n elements. Inputs with more runs than
+     * base cases are sample sorted, so that random inputs give up after a short scan.
+     */
+    static diff_t maxRuns(const diff_t n) {
+        const diff_t max_runs = Cfg::kMaxNaturalRuns;
+        return std::min(max_runs, std::max(n / Cfg::kBaseCaseSize, diff_t(1)));
+    }
+
+    NaturalRuns(iterator begin, const less& comp, memory_resource* resource)
+        : begin_(std::move(begin))
+        , comp_(comp)
+        , resource_(resource)
+        , run_ends_(resource)
+        , overlaps_(resource)
+        , split_ranks_(resource) {}
+
+    /**
+     * Finds the runs in [first, last) and appends their ends to run_ends.
+     * Returns false once there are more than max_runs runs or stop is set.
+     */
+    bool find(diff_t first, const diff_t last, const diff_t max_runs,
+              Vector<diff_t>& run_ends, const std::atomic<bool>& stop) const {
+        const auto run_begin = run_ends.size();
+        while (first < last) {
+            auto i = first + 1;
+            if (i < last && comp_(begin_[i], begin_[i - 1])) {
+                while (++i < last && comp_(begin_[i], begin_[i - 1])) {}
+                std::reverse(begin_ + first, begin_ + i);
+            }
+            while (i < last && !comp_(begin_[i], begin_[i - 1])) ++i;
+
+            // A reversed run may continue the previous run
+            if (run_ends.size() > run_begin && !comp_(begin_[first], begin_[first - 1]))
+                run_ends.back() = i;
+            else
+                run_ends.push_back(i);
+
+            if (static_cast<diff_t>(run_ends.size() - run_begin) > max_runs
+                || stop.load(std::memory_order_relaxed))
+                return false;
+            first = i;
+        }
+        return true;
+    }
+
+    /**
+     * Concatenates the runs found in consecutive stripes, joining runs that
+     * continue across stripe boundaries.
+     */
+    void join(const Vector<Vector<diff_t>>& stripe_run_ends) {
+        run_ends_.clear();
+        for (const auto& ends : stripe_run_ends) {
+            if (ends.empty()) continue;
+            const bool continues = !run_ends_.empty()
+                                   && !comp_(begin_[run_ends_.back()],
+                                             begin_[run_ends_.back() - 1]);
+            if (continues) run_ends_.pop_back();
+            run_ends_.insert(run_ends_.end(), ends.begin(), ends.end());
+        }
+    }
+
+    Vector<diff_t>& runEnds() { return run_ends_; }
+
+    diff_t numRuns() const { return run_ends_.size(); }
+
+    /**
+     * Pairs up adjacent runs and computes their overlaps. Returns false as soon as
+     * the remaining rounds are expected to exceed the budget, assuming that later
+     * rounds merge as many elements as this one. Otherwise, the work of this round
+     * is taken from the budget.
+     */
+    bool planRound(diff_t& budget) {
+        overlaps_.clear();
+        const diff_t rounds = detail::log2(run_ends_.size() - 1) + 1;
+        diff_t work = 0;
+        diff_t run_begin = 0;
+        std::size_t num_runs = 0;
+        for (std::size_t r = 0; r < run_ends_.size(); r += 2) {
+            if (r + 1 == run_ends_.size()) {
+                run_ends_[num_runs++] = run_ends_[r];
+                break;
+            }
+            const auto mid = run_ends_[r];
+            const auto run_end = run_ends_[r + 1];
+            if (comp_(begin_[mid], begin_[mid - 1])) {
+                const auto first =
+                        std::upper_bound(begin_ + run_begin, begin_ + mid, begin_[mid], comp_)
+                        - begin_;
+                const auto last = std::lower_bound(begin_ + mid, begin_ + run_end,
+                                                   begin_[mid - 1], comp_)
+                                  - begin_;
+                overlaps_.push_back({first, mid, last, work});
+                work += last - first;
+                if (work * rounds > budget) return false;
+            }
+            run_ends_[num_runs++] = run_end;
+            run_begin = run_end;
+        }
+        run_ends_.resize(num_runs);
+        work_ = work;
+        budget -= work;
+        return true;
+    }
+
+    /**
+     * Number of elements to merge in the current round.
+     */
+    diff_t work() const { return work_; }
+
+    /**
+     * Allocates scratch memory and splits the work of the round evenly among
+     * num_threads threads. Split points are computed before any thread moves
+     * elements.
+     */
+    void prepareRound(const int num_threads) {
+        if (work_ > scratch_size_) {
+            scratch_ = AlignedPtr<void>(resource_, Cfg::kDataAlignment,
+                                        work_ * sizeof(value_type));
+            scratch_size_ = work_;
+        }
+
+        split_ranks_.assign(num_threads + 1, 0);
+        auto o = overlaps_.begin();
+        for (int t = 1; t < num_threads && work_ > 0; ++t) {
+            const auto k = work_ * t / num_threads;
+            while (o->offset + (o->end - o->begin) <= k) ++o;
+            split_ranks_[t] = coRank(begin_ + o->begin, o->mid - o->begin,
+                                     begin_ + o->mid, o->end - o->mid, k - o->offset);
+        }
+    }
+
+    /**
+     * Merges the part of the overlaps assigned to thread my_id into the scratch buffer.
+     */
+    void merge(const int my_id, const int num_threads) {
+        const auto my_begin = work_ * my_id / num_threads;
+        const auto my_end = work_ * (my_id + 1) / num_threads;
+        value_type* const scratch = scratchData();
+
+        for (const auto& o : overlaps_) {
+            const auto first = std::max(my_begin - o.offset, diff_t(0));
+            const auto last = std::min(my_end - o.offset, o.end - o.begin);
+            if (first >= last) continue;
+
+            const auto a = begin_ + o.begin;
+            const auto b = begin_ + o.mid;
+            const auto size_a = o.mid - o.begin;
+            const auto i = first == 0 ? 0 : split_ranks_[my_id];
+            const auto i_end = last == o.end - o.begin ? size_a : split_ranks_[my_id + 1];
+            mergeTo(a + i, i_end - i, b + (first - i), (last - i_end) - (first - i),
+                    scratch + o.offset + first);
+        }
+    }
+
+    /**
+     * Moves the part of the merged overlaps assigned to thread my_id back.
+     */
+    void moveBack(const int my_id, const int num_threads) {
+        const auto my_begin = work_ * my_id / num_threads;
+        const auto my_end = work_ * (my_id + 1) / num_threads;
+        value_type* const scratch = scratchData();
+
+        for (const auto& o : overlaps_) {
+            const auto first = std::max(my_begin - o.offset, diff_t(0));
+            const auto last = std::min(my_end - o.offset, o.end - o.begin);
+            for (auto k = first; k < last; ++k) {
+                value_type& v = scratch[o.offset + k];
+                begin_[o.begin + k] = std::move(v);
+                v.~value_type();
+            }
+        }
+    }
+
+ private:
+    value_type* scratchData() {
+        return static_cast<value_type*>(static_cast<void*>(scratch_.get()));
+    }
+
+    /**
+     * Number of elements of a among the first k elements of the merge of a and b.
+     * Ties are taken from a first.
+     */
+    diff_t coRank(const iterator a, const diff_t size_a, const iterator b,
+                  const diff_t size_b, const diff_t k) const {
+        auto lo = std::max(diff_t(0), k - size_b);
+        auto hi = std::min(k, size_a);
+        while (lo < hi) {
+            const auto i = lo + (hi - lo) / 2;
+            if (comp_(b[k - i - 1], a[i]))
+                hi = i;
+            else
+                lo = i + 1;
+        }
+        return lo;
+    }
+
+    void mergeTo(const iterator a, const diff_t size_a, const iterator b,
+                 const diff_t size_b, value_type* out) const {
+        diff_t i = 0;
+        diff_t j = 0;
+        while (i < size_a && j < size_b) {
+            const bool take_b = comp_(b[j], a[i]);
+            new (out++) value_type(std::move(take_b ? b[j] : a[i]));
+            j += take_b;
+            i += !take_b;
+        }
+        for (; i < size_a; ++i) new (out++) value_type(std::move(a[i]));
+        for (; j < size_b; ++j) new (out++) value_type(std::move(b[j]));
+    }
+
+    iterator begin_;
+    const less& comp_;
+    memory_resource* const resource_;
+    Vector<diff_t> run_ends_;
+    Vector<Overlap> overlaps_;
+    Vector<diff_t> split_ranks_;
+    AlignedPtr<void> scratch_;
+    diff_t scratch_size_ = 0;
+    diff_t work_ = 0;
+};
+
+/**
+ * Sorts [begin, end) if it consists of at most NaturalRuns::maxRuns natural runs
+ * and merging them moves at most kMergeBudget times the input size.
+ * Returns false, leaving the input permuted, otherwise.
+ * With kMaxNaturalRuns = 1, only sorted and reversed inputs are detected.
+ * Run ends and scratch memory are allocated from the resource.
+ */
+template <class Cfg>
+bool sortNaturalRuns(typename Cfg::iterator begin, typename Cfg::iterator end,
+                     const typename Cfg::less& comp,
+                     memory_resource* resource = get_default_resource()) {
+    using diff_t = typename Cfg::difference_type;
+
+    NaturalRuns<Cfg> runs(begin, comp, resource);
+    const std::atomic<bool> stop{false};
+    const auto max_runs = NaturalRuns<Cfg>::maxRuns(end - begin);
+    if (!runs.find(0, end - begin, max_runs, runs.runEnds(), stop)) return false;
+
+    diff_t budget = NaturalRuns<Cfg>::kMergeBudget * (end - begin);
+    while (runs.numRuns() > 1) {
+        if (!runs.planRound(budget)) return false;
+        runs.prepareRound(1);
+        runs.merge(0, 1);
+        runs.moveBack(0, 1);
+    }
+    return true;
+}
+
+#if defined(_REENTRANT)
+
+/**
+ * Parallel version: each thread scans a stripe, and large rounds are merged in
+ * parallel.
+ */
+template <class Cfg, class ThreadPool>
+bool sortNaturalRuns(typename Cfg::iterator begin, typename Cfg::iterator end,
+                     const typename Cfg::less& comp, ThreadPool& thread_pool,
+                     memory_resource* resource) {
+    using diff_t = typename Cfg::difference_type;
+
+    const int num_threads = thread_pool.numThreads();
+    NaturalRuns<Cfg> runs(begin, comp, resource);
+    Vector<Vector<diff_t>> stripe_run_ends(resource);
+    stripe_run_ends.reserve(num_threads);
+    for (int i = 0; i != num_threads; ++i) stripe_run_ends.emplace_back(resource);
+    std::atomic<bool> stop{false};
+    const auto max_runs = NaturalRuns<Cfg>::maxRuns(end - begin);
+    thread_pool(
+            [begin, end, max_runs, &runs, &stripe_run_ends, &stop](int my_id,
+                                                                   int num_threads) {
+                const diff_t size = end - begin;
+                const diff_t stripe = (size + num_threads - 1) / num_threads;
+                const auto first = std::min(stripe * my_id, size);
+                const auto last = std::min(stripe * (my_id + 1), size);
+                if (!runs.find(first, last, max_runs, stripe_run_ends[my_id], stop))
+                    stop.store(true, std::memory_order_relaxed);
+            },
+            num_threads);
+    if (stop.load(std::memory_order_relaxed)) return false;
+
+    runs.join(stripe_run_ends);
+    if (runs.numRuns() > max_runs) return false;
+
+    diff_t budget = NaturalRuns<Cfg>::kMergeBudget * (end - begin);
+    while (runs.numRuns() > 1) {
+        if (!runs.planRound(budget)) return false;
+        const auto work = runs.work();
+
+        // Small rounds are not worth waking up the threads
+        const int round_threads = work < num_threads * Cfg::kBlockSize ? 1 : num_threads;
+        runs.prepareRound(round_threads);
+        if (round_threads == 1) {
+            runs.merge(0, 1);
+            runs.moveBack(0, 1);
+        } else {
+            thread_pool([&runs](int my_id, int num_threads) { runs.merge(my_id, num_threads); },
+                        num_threads);
+            thread_pool(
+                    [&runs](int my_id, int num_threads) { runs.moveBack(my_id, num_threads); },
+                    num_threads);
+        }
+    }
+    return true;
+}
+
+#endif  // _REENTRANT
+
+}  // namespace detail
+}  // namespace ips4o
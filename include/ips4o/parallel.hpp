@@ -47,14 +47,16 @@
 #include <utility>
 #include <vector>
 
-#include <tbb/concurrent_queue.h>
 
 #include "ips4o_fwd.hpp"
 #include "config.hpp"
 #include "memory.hpp"
+#include "memory_resource.hpp"
+#include "natural_runs.hpp"
 #include "partitioning.hpp"
 #include "scheduler.hpp"
 #include "sequential.hpp"
+#include "splitter_cache.hpp"
 #include "task.hpp"
 
 namespace ips4o {
@@ -64,14 +66,16 @@ namespace detail {
  * Processes sequential subtasks in the parallel algorithm.
  */
 template <class Cfg>
-void Sorter<Cfg>::processSmallTasks(const iterator begin) {
+void Sorter<Cfg>::processSmallTasks(const iterator begin, const int id) {
     auto& scheduler = shared_->scheduler;
     auto& my_queue = local_.seq_task_queue;
+    const auto queue_of = [this](const int i) -> WorkStealingDeque<Task>& {
+        return shared_->local[i]->seq_task_queue;
+    };
     Task task;
     auto comp = local_.classifier.getComparator();
 
-    while (scheduler.getJob(my_queue, task)) {
-        scheduler.offerJob(my_queue);
+    while (scheduler.getJob(id, queue_of, task)) {
         if (task.end - task.begin <= 2 * Cfg::kBaseCaseSize) {
 #ifdef IPS4O_TIMER
             g_overhead.stop();
@@ -115,7 +119,7 @@ void Sorter<Cfg>::queueTasks(const diff_t stripe, const int id,
 
         } else {
             shared_->thread_pools[thread_begin] =
-                    std::make_shared<SubThreadPool>(thread_end - thread_begin);
+                    &shared_->sub_thread_pools.acquire(thread_end - thread_begin);
 
             for (auto t = thread_begin; t != thread_end; ++t) {
                 auto& bt = shared_->big_tasks[t];
@@ -142,11 +146,22 @@ void Sorter<Cfg>::queueTasks(const diff_t stripe, const int id,
             if (start < stop) queueTask(start, stop);
         }
 
+        // A bucket much larger than the others is queued last, so that the thread
+        // owning it starts with it and idle threads steal its other tasks
+        const auto largest = largestBucket(bucket_start, num_buckets, equal_buckets);
+        const std::uint64_t factor = Cfg::kImbalanceFactorPercent;
+        const int imbalanced_bucket = largest.second > factor ? largest.first : -1;
+
         // Skip equality buckets
         for (int i = num_buckets - 1 - equal_buckets; i >= 0; i -= 1 + equal_buckets) {
             const auto start = bucket_start[i];
             const auto stop = bucket_start[i + 1];
-            if (start < stop) queueTask(start, stop);
+            if (start < stop && i != imbalanced_bucket) queueTask(start, stop);
+        }
+        if (imbalanced_bucket != -1) {
+            const auto start = bucket_start[imbalanced_bucket];
+            const auto stop = bucket_start[imbalanced_bucket + 1];
+            queueTask(start, stop);
         }
     }
 }
@@ -156,8 +171,7 @@ void Sorter<Cfg>::queueTasks(const diff_t stripe, const int id,
  */
 template <class Cfg>
 void Sorter<Cfg>::processBigTasks(const iterator begin, const diff_t stripe, const int id,
-                                  BufferStorage& buffer_storage,
-                                  std::vector<std::shared_ptr<SubThreadPool>>& tp_trash) {
+                                  BufferStorage& buffer_storage) {
     BigTask& task = shared_->big_tasks[id];
 
     while (task.has_task) {
@@ -165,7 +179,7 @@ void Sorter<Cfg>::processBigTasks(const iterator begin, const diff_t stripe, con
             // Only thread 0 passes a task sorter (the one stored in this
             // object). The other threads have to create a task sorter if
             // required.
-            processBigTaskPrimary(begin, stripe, id, buffer_storage, tp_trash);
+            processBigTaskPrimary(begin, stripe, id, buffer_storage);
         } else {
             processBigTasksSecondary(id);
         }
@@ -186,7 +200,7 @@ void Sorter<Cfg>::setShared(SharedData* shared) {
 template <class Cfg>
 void Sorter<Cfg>::processBigTasksSecondary(const int id) {
     BigTask& task = shared_->big_tasks[id];
-    auto partial_thread_pool = shared_->thread_pools[task.root_thread];
+    auto* const partial_thread_pool = shared_->thread_pools[task.root_thread];
 
     partial_thread_pool->join(task.task_thread_id);
 }
@@ -197,48 +211,51 @@ void Sorter<Cfg>::processBigTasksSecondary(const int id) {
 template <class Cfg>
 void Sorter<Cfg>::processBigTaskPrimary(
         const iterator begin, const diff_t stripe, const int id,
-        BufferStorage& buffer_storage,
-        std::vector<std::shared_ptr<SubThreadPool>>& tp_trash) {
+        BufferStorage& buffer_storage) {
     BigTask& task = shared_->big_tasks[id];
 
-    // Thread pool of this task.
-    auto partial_thread_pool = shared_->thread_pools[id];
+    // Thread pool of this task. It stays in use until its threads are released, even
+    // if queueTasks gives this thread a new one.
+    auto* const partial_thread_pool = shared_->thread_pools[id];
 
     using Sorter =
             Sorter<ExtendedConfig<iterator, decltype(shared_->classifier.getComparator()),
-                                  Config<>, SubThreadPool>>;
+                                  typename Cfg::BaseConfig, SubThreadPool>>;
 
     // Create shared data.
+    auto* const resource = shared_->resource;
     detail::AlignedPtr<typename Sorter::SharedData> partial_shared_ptr(
-            Cfg::kDataAlignment, shared_->classifier.getComparator(),
-            partial_thread_pool->sync(), partial_thread_pool->numThreads());
+            resource, Cfg::kDataAlignment, shared_->classifier.getComparator(),
+            partial_thread_pool->sync(), partial_thread_pool->numThreads(), resource);
     auto& partial_shared = partial_shared_ptr.get();
+    partial_shared.statistics = shared_->statistics;
 
-    // Create local data.
-    typename Sorter::BufferStorage partial_buffer_storage(
-            partial_thread_pool->numThreads());
-    std::unique_ptr<detail::AlignedPtr<typename Sorter::LocalData>[]> partial_local_ptrs(
-            new detail::AlignedPtr<
-                    typename Sorter::LocalData>[partial_thread_pool->numThreads()]);
+    // Create local data. The threads keep their buffers of the top level.
+    Vector<detail::AlignedPtr<typename Sorter::LocalData>> partial_local_ptrs(resource);
+    partial_local_ptrs.reserve(partial_thread_pool->numThreads());
 
     for (int i = 0; i != partial_thread_pool->numThreads(); ++i) {
-        partial_local_ptrs[i] = detail::AlignedPtr<typename Sorter::LocalData>(
-                Cfg::kDataAlignment, shared_->classifier.getComparator(),
-                buffer_storage.forThread(task.root_thread + i));
+        partial_local_ptrs.push_back(detail::AlignedPtr<typename Sorter::LocalData>(
+                resource, Cfg::kDataAlignment, shared_->classifier.getComparator(),
+                buffer_storage.forThread(task.root_thread + i), task.root_thread + i,
+                resource));
+        partial_local_ptrs[i].get().max_log_buckets = local_.max_log_buckets;
         partial_shared.local[i] = &partial_local_ptrs[i].get();
     }
 
-    std::pair<std::vector<diff_t>, bool> ret;
+    diff_t offsets[Cfg::kMaxBuckets + 1];
+    std::pair<int, bool> ret;
 
     // Execute in parallel
     partial_thread_pool->operator()(
-            [&partial_shared, begin, &task, &ret](int partial_id,
-                                                  int partial_num_threads) {
+            [&partial_shared, begin, &task, &ret, &offsets](int partial_id,
+                                                            int partial_num_threads) {
                 Sorter sorter(*partial_shared.local[partial_id]);
                 sorter.setShared(&partial_shared);
                 if (partial_id == 0) {
-                    ret = sorter.parallelPartitionPrimary(
-                            begin + task.begin, begin + task.end, partial_num_threads);
+                    ret = sorter.parallelPartitionPrimary(begin + task.begin,
+                                                          begin + task.end,
+                                                          partial_num_threads, offsets);
                 } else {
                     sorter.parallelPartitionSecondary(begin + task.begin,
                                                       begin + task.end, partial_id,
@@ -247,15 +264,11 @@ void Sorter<Cfg>::processBigTaskPrimary(
             },
             partial_thread_pool->numThreads());
 
-    const auto& offsets = ret.first;
+    const int num_buckets = ret.first;
     const auto equal_buckets = ret.second;
-    const int num_buckets = offsets.size() - 1;
-
-    // Move my thread pool to the trash as I might create a new one.
-    tp_trash.emplace_back(std::move(shared_->thread_pools[id]));
 
     queueTasks(stripe, id, partial_thread_pool->numThreads(), task.end - task.begin,
-               task.begin, offsets.data(), num_buckets, equal_buckets);
+               task.begin, offsets, num_buckets, equal_buckets);
 
     partial_thread_pool->release_threads();
 }
@@ -277,21 +290,20 @@ void Sorter<Cfg>::parallelPartitionSecondary(const iterator begin, const iterato
  * the first thread.
  */
 template <class Cfg>
-std::pair<std::vector<typename Cfg::difference_type>, bool>
-Sorter<Cfg>::parallelPartitionPrimary(const iterator begin, const iterator end,
-                                      const int num_threads) {
+std::pair<int, bool> Sorter<Cfg>::parallelPartitionPrimary(const iterator begin,
+                                                           const iterator end,
+                                                           const int num_threads,
+                                                           diff_t* bucket_start) {
 
     const auto res = partition<true>(begin, end, shared_->bucket_start, 0, num_threads);
     const int num_buckets = std::get<0>(res);
-    const bool equal_buckets = std::get<1>(res);
 
-    std::vector<diff_t> bucket_start(shared_->bucket_start,
-                                     shared_->bucket_start + num_buckets + 1);
+    std::copy_n(shared_->bucket_start, num_buckets + 1, bucket_start);
 
     shared_->reset();
     shared_->sync.barrier();
 
-    return {bucket_start, equal_buckets};
+    return res;
 }
 
 /**
@@ -300,16 +312,15 @@ Sorter<Cfg>::parallelPartitionPrimary(const iterator begin, const iterator end,
 template <class Cfg>
 void Sorter<Cfg>::parallelSortSecondary(
         const iterator begin, const iterator end, int id, int num_threads,
-        BufferStorage& buffer_storage,
-        std::vector<std::shared_ptr<SubThreadPool>>& tp_trash) {
+        BufferStorage& buffer_storage) {
     shared_->local[id] = &local_;
 
     partition<true>(begin, end, shared_->bucket_start, id, num_threads);
     shared_->sync.barrier();
 
     const auto stripe = ((end - begin) + num_threads - 1) / num_threads;
-    processBigTasks(begin, stripe, id, buffer_storage, tp_trash);
-    processSmallTasks(begin);
+    processBigTasks(begin, stripe, id, buffer_storage);
+    processSmallTasks(begin, id);
 }
 
 /**
@@ -318,8 +329,7 @@ void Sorter<Cfg>::parallelSortSecondary(
 template <class Cfg>
 void Sorter<Cfg>::parallelSortPrimary(
         const iterator begin, const iterator end, const int num_threads,
-        BufferStorage& buffer_storage,
-        std::vector<std::shared_ptr<SubThreadPool>>& tp_trash) {
+        BufferStorage& buffer_storage) {
     const auto res = partition<true>(begin, end, shared_->bucket_start, 0, num_threads);
 
     const bool is_last_level = end - begin <= Cfg::kSingleLevelThreshold;
@@ -336,8 +346,8 @@ void Sorter<Cfg>::parallelSortPrimary(
     shared_->reset();
     shared_->sync.barrier();
 
-    processBigTasks(begin, stripe, 0, buffer_storage, tp_trash);
-    processSmallTasks(begin);
+    processBigTasks(begin, stripe, 0, buffer_storage);
+    processSmallTasks(begin, 0);
 }
 
 }  // namespace detail
@@ -353,27 +363,49 @@ class ParallelSorter {
  public:
     /**
      * Construct the sorter. Thread pool may be passed by reference.
+     * Buffers, shared and thread-local data are allocated from the resource.
+     * The buffers are allocated by the first sort which needs them and grow with the
+     * number of threads and buckets of later sorts, within the memory budget.
      */
     ParallelSorter(typename Cfg::less comp, typename Cfg::ThreadPool thread_pool,
-                   bool check_sorted)
+                   bool check_sorted, memory_resource* resource = get_default_resource())
         : check_sorted_(check_sorted)
+        , resource_(resource)
         , thread_pool_(std::forward<typename Cfg::ThreadPool>(thread_pool))
-        , shared_ptr_(Cfg::kDataAlignment, std::move(comp), thread_pool_.sync(),
-                      thread_pool_.numThreads())
-        , buffer_storage_(thread_pool_.numThreads())
-        , local_ptrs_(new detail::AlignedPtr<
-                      typename Sorter::LocalData>[thread_pool_.numThreads()])
+        , shared_ptr_(resource, Cfg::kDataAlignment, std::move(comp), thread_pool_.sync(),
+                      thread_pool_.numThreads(), resource)
+        , local_ptrs_(thread_pool_.numThreads(), resource)
+        , splitter_cache_(resource)
     {
         // Allocate local data and reuse memory of the previous recursion level
-        thread_pool_([this](int my_id, int) {
+        thread_pool_([this, resource](int my_id, int) {
             auto& shared = this->shared_ptr_.get();
             this->local_ptrs_[my_id] = detail::AlignedPtr<typename Sorter::LocalData>(
-                    Cfg::kDataAlignment, shared.classifier.getComparator(),
-                    buffer_storage_.forThread(my_id));
+                    resource, Cfg::kDataAlignment, shared.classifier.getComparator(),
+                    nullptr, my_id, resource);
             shared.local[my_id] = &this->local_ptrs_[my_id].get();
         });
     }
 
+    /**
+     * Keeps the top-level splitters of a sort for the next sorts. Kept or supplied
+     * splitters are dropped as soon as the largest bucket of a sort holds more than
+     * max_imbalance times the average, and the next sort samples again.
+     */
+    void reuse_splitters(const bool enable, const double max_imbalance = 4.0) {
+        splitter_cache_.setReuse(enable, max_imbalance);
+    }
+
+    /**
+     * Uses the given keys as top-level splitters instead of sampling. At most
+     * 2^kLogBuckets - 1 evenly spaced distinct keys are used.
+     */
+    template <class KeyIt>
+    void set_splitters(KeyIt first, KeyIt last) {
+        const auto& comp = shared_ptr_.get().classifier.keyLess();
+        splitter_cache_.assign(std::move(first), std::move(last), comp);
+    }
+
     /**
      * Sort in parallel.
      */
@@ -381,43 +413,114 @@ class ParallelSorter {
         // Sort small input sequentially
         const int num_threads = Cfg::numThreadsFor(begin, end, thread_pool_.numThreads());
         if (num_threads < 2 || end - begin <= 2 * Cfg::kBaseCaseSize) {
-            Sorter(local_ptrs_[0].get()).sequential(std::move(begin), std::move(end));
+            reserveBuffers(end - begin, 1);
+            auto& local = local_ptrs_[0].get();
+            local.splitter_cache = &splitter_cache_;
+            local.statistics = &statistics_;
+            Sorter(local).sequential(std::move(begin), std::move(end));
+            local.splitter_cache = nullptr;
+            local.statistics = nullptr;
             return;
         }
 
-        if (check_sorted_
-            && detail::isSorted(begin, end,
-                                local_ptrs_[0].get().classifier.getComparator(),
-                                thread_pool_)) {
-            return;
+        if (check_sorted_) {
+            const auto& comp = local_ptrs_[0].get().classifier.getComparator();
+            if (detail::sortSimpleCases(begin, end, comp, thread_pool_)
+                || detail::sortNaturalRuns<Cfg>(begin, end, comp, thread_pool_, resource_))
+                return;
         }
 
         // Set up base data before switching to parallel mode
-        // auto& shared = shared_ptr_.get();
+        reserveBuffers(end - begin, num_threads);
+        auto& shared = shared_ptr_.get();
+        shared.splitter_cache = &splitter_cache_;
+        shared.statistics = &statistics_;
+        for (int i = 0; i != num_threads; ++i) shared.local[i]->statistics = &statistics_;
 
         // Execute in parallel
         thread_pool_(
                 [this, begin, end](int my_id, int num_threads) {
-                    std::vector<std::shared_ptr<typename Sorter::SubThreadPool>> tp_trash;
                     auto& shared = this->shared_ptr_.get();
                     Sorter sorter(*shared.local[my_id]);
                     sorter.setShared(&shared);
                     if (my_id == 0)
                         sorter.parallelSortPrimary(begin, end, num_threads,
-                                                   buffer_storage_, tp_trash);
+                                                   buffer_storage_);
                     else
                         sorter.parallelSortSecondary(begin, end, my_id, num_threads,
-                                                     buffer_storage_, tp_trash);
+                                                     buffer_storage_);
                 },
                 num_threads);
+
+        for (int i = 0; i != num_threads; ++i) shared.local[i]->statistics = nullptr;
+        shared.statistics = nullptr;
     }
 
+    /**
+     * Returns the statistics of all partitioning steps since construction or the
+     * last reset.
+     */
+    const partition_statistics& statistics() const { return statistics_; }
+
+    void reset_statistics() { statistics_ = partition_statistics(); }
+
+    /**
+     * Limits the buffers to the given number of bytes by using fewer buckets, which
+     * may take more recursion levels. A budget of zero means no limit.
+     */
+    void set_memory_budget(const std::size_t bytes) { memory_budget_ = bytes; }
+
+    /**
+     * Returns the number of bytes of the buffers of all threads.
+     */
+    std::size_t buffer_bytes() const { return buffer_storage_.bytes(); }
+
  private:
+    /**
+     * Makes sure that the buffers hold all buckets of a sort of n elements with the
+     * given number of threads.
+     */
+    void reserveBuffers(const typename Cfg::difference_type n, const int num_threads) {
+        if (n <= 2 * Cfg::kBaseCaseSize) return;
+        auto& shared = shared_ptr_.get();
+        const int max_log_buckets = Sorter::maxLogBuckets(n, memory_budget_, num_threads);
+        for (int i = 0; i != num_threads; ++i)
+            shared.local[i]->max_log_buckets = max_log_buckets;
+
+        const int num_buckets = Sorter::bufferBuckets(max_log_buckets);
+        // Shrink buffers which a sort before the budget was set has grown
+        const bool over_budget = memory_budget_ != 0
+                                 && num_buckets < buffer_storage_.numBuckets()
+                                 && buffer_storage_.bytes() > memory_budget_;
+        if (num_threads <= buffer_storage_.numThreads()
+            && num_buckets <= buffer_storage_.numBuckets() && !over_budget)
+            return;
+
+        // Otherwise, grow to the largest sort so far, so that sorts of mixed sizes do
+        // not reallocate each time. Threads beyond num_threads get their buffers back
+        // as soon as a sort uses them.
+        const int storage_threads =
+                over_budget ? num_threads
+                            : std::max(num_threads, buffer_storage_.numThreads());
+        const int storage_buckets =
+                over_budget ? num_buckets
+                            : std::max(num_buckets, buffer_storage_.numBuckets());
+        buffer_storage_ = typename Sorter::BufferStorage();
+        buffer_storage_ = typename Sorter::BufferStorage(storage_threads, resource_,
+                                                         storage_buckets);
+        for (int i = 0; i != storage_threads; ++i)
+            shared.local[i]->buffers.setStorage(buffer_storage_.forThread(i));
+    }
+
     const bool check_sorted_;
+    memory_resource* const resource_;
+    std::size_t memory_budget_ = 0;
     typename Cfg::ThreadPool thread_pool_;
     detail::AlignedPtr<typename Sorter::SharedData> shared_ptr_;
     typename Sorter::BufferStorage buffer_storage_;
-    std::unique_ptr<detail::AlignedPtr<typename Sorter::LocalData>[]> local_ptrs_;
+    detail::Vector<detail::AlignedPtr<typename Sorter::LocalData>> local_ptrs_;
+    detail::SplitterCache<Cfg> splitter_cache_;
+    partition_statistics statistics_;
 };
 
 }  // namespace ips4o
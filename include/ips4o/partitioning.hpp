@@ -36,6 +36,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <tuple>
 #include <utility>
 
@@ -44,12 +45,36 @@
 #include "cleanup_margins.hpp"
 #include "local_classification.hpp"
 #include "memory.hpp"
+#include "radix.hpp"
 #include "sampling.hpp"
+#include "splitter_cache.hpp"
 #include "utils.hpp"
 
 namespace ips4o {
 namespace detail {
 
+/**
+ * Returns the largest bucket, equality buckets excluded, and its size relative to the
+ * average bucket size in percent.
+ */
+template <class Cfg>
+std::pair<int, std::uint64_t> Sorter<Cfg>::largestBucket(const diff_t* bucket_start,
+                                                         const int num_buckets,
+                                                         const bool equal_buckets) {
+    const int step = 1 + equal_buckets;
+    int largest = 0;
+    for (int i = step; i < num_buckets; i += step) {
+        if (bucket_start[i + 1] - bucket_start[i]
+            > bucket_start[largest + 1] - bucket_start[largest])
+            largest = i;
+    }
+
+    const diff_t n = bucket_start[num_buckets] - bucket_start[0];
+    const double size = bucket_start[largest + 1] - bucket_start[largest];
+    const auto percent = n == 0 ? 0 : 100.0 * size * (num_buckets / step) / n;
+    return {largest, static_cast<std::uint64_t>(percent)};
+}
+
 /**
  * Main partitioning function.
  */
@@ -63,19 +88,98 @@ std::pair<int, bool> Sorter<Cfg>::partition(const iterator begin, const iterator
     g_sampling.start();
 #endif
 
+    // Splitters kept by a reusable sorter, only used on the top level
+    SplitterCache<Cfg>* const splitter_cache =
+            kIsParallel ? shared_->splitter_cache : local_.splitter_cache;
+    if (!kIsParallel) local_.splitter_cache = nullptr;
+
+    // Parallel steps are large enough to check for sorted input first
+    const bool is_sorted = kIsParallel && checkSorted(begin, end, my_id, num_threads);
+
+    // Radix sorters need the bits in which the keys differ
+    const auto radix_difference =
+            is_sorted ? 0 : radixDifference<kIsParallel>(begin, end, my_id, num_threads);
+
+    if (is_sorted || (Cfg::kRadixSort && radix_difference == 0)) {
+        // The range is sorted or all keys are equal. Report a single equality bucket,
+        // which is not recursed on.
+        if (my_id == 0) {
+            bucket_start[0] = bucket_start[1] = 0;
+            bucket_start[2] = bucket_start[3] = bucket_start[4] = end - begin;
+        }
+        if (kIsParallel) shared_->sync.barrier();
+
+#ifdef IPS4O_TIMER
+        g_sampling.stop();
+        g_overhead.start();
+#endif
+
+        return {4, true};
+    }
+
     // Sampling
     bool use_equal_buckets = false;
+    const auto num_blocks = (end - begin) / Cfg::kBlockSize + 1;
+    const auto keep_splitters = [&](Classifier& classifier, bool equal_buckets) {
+        if (splitter_cache && splitter_cache->keepsSampled()
+            && classifier.getLogBuckets() > 0)
+            splitter_cache->assign(classifier.getSortedSplitters(),
+                                   classifier.getLogBuckets(), equal_buckets,
+                                   classifier.keyLess());
+    };
+    const bool use_cache = splitter_cache && splitter_cache->usableFor(end - begin)
+                           && splitter_cache->logBuckets() <= local_.max_log_buckets;
     {
         if (!kIsParallel) {
-            std::tie(this->num_buckets_, use_equal_buckets) =
-                    buildClassifier(begin, end, local_.classifier);
+            if (use_cache) {
+                std::tie(this->num_buckets_, use_equal_buckets) =
+                        buildClassifier(*splitter_cache, local_.classifier);
+            } else {
+                std::tie(this->num_buckets_, use_equal_buckets) = buildRadixClassifier(
+                        begin, end, radix_difference, local_.classifier);
+                keep_splitters(local_.classifier, use_equal_buckets);
+            }
+            if (static_cast<diff_t>(local_.block_tags.size()) < num_blocks)
+                local_.block_tags.resize(num_blocks);
         } else {
+            // Kept splitters and radix digits need no sample
             shared_->sync.single([&] {
-                std::tie(this->num_buckets_, use_equal_buckets) =
-                        buildClassifier(begin, end, shared_->classifier);
-                shared_->num_buckets = this->num_buckets_;
-                shared_->use_equal_buckets = use_equal_buckets;
+                auto& classifier = shared_->classifier;
+                if (use_cache) {
+                    std::tie(shared_->num_buckets, shared_->use_equal_buckets) =
+                            buildClassifier(*splitter_cache, classifier);
+                } else {
+                    shared_->num_buckets =
+                            radixClassifier(begin, end, radix_difference, classifier);
+                    shared_->use_equal_buckets = false;
+                }
+                if (static_cast<diff_t>(shared_->block_tags.size()) < num_blocks)
+                    shared_->block_tags.resize(num_blocks);
             });
+
+            // Otherwise, all threads draw and sort the sample
+            if (shared_->num_buckets == 0) {
+                int log_buckets;
+                diff_t step, num_samples;
+                std::tie(log_buckets, step, num_samples) =
+                        sampleParameters(end - begin, local_.max_log_buckets);
+                parallelSample(begin, end, num_samples, my_id, num_threads);
+
+                shared_->sync.single([&] {
+                    auto& classifier = shared_->classifier;
+                    auto& sample = shared_->local[0]->sample;
+                    std::tie(shared_->num_buckets, shared_->use_equal_buckets) =
+                            buildClassifierFromSample(
+                                    sample.begin(), sample.end(), log_buckets, step,
+                                    [](const typename Cfg::key_type& key)
+                                            -> const typename Cfg::key_type& {
+                                        return key;
+                                    },
+                                    classifier);
+                    sample.clear();
+                    keep_splitters(classifier, shared_->use_equal_buckets);
+                });
+            }
             this->num_buckets_ = shared_->num_buckets;
             use_equal_buckets = shared_->use_equal_buckets;
         }
@@ -87,6 +191,8 @@ std::pair<int, bool> Sorter<Cfg>::partition(const iterator begin, const iterator
     this->bucket_start_ = bucket_start;
     this->bucket_pointers_ =
             kIsParallel ? shared_->bucket_pointers : local_.bucket_pointers;
+    this->block_tags_ =
+            kIsParallel ? shared_->block_tags.data() : local_.block_tags.data();
     this->overflow_ = nullptr;
     this->begin_ = begin;
     this->end_ = end;
@@ -109,6 +215,19 @@ std::pair<int, bool> Sorter<Cfg>::partition(const iterator begin, const iterator
     g_permutation.start();
 #endif
 
+    // Drop kept splitters which no longer fit the data
+    if (splitter_cache && my_id == 0)
+        splitter_cache->validate(bucket_start_, num_buckets_, use_equal_buckets);
+
+    // Record how well the splitters fit the data
+    auto* const statistics = kIsParallel ? shared_->statistics : local_.statistics;
+    if (statistics && my_id == 0) {
+        const std::uint64_t factor = Cfg::kImbalanceFactorPercent;
+        const auto imbalance =
+                largestBucket(bucket_start_, num_buckets_, use_equal_buckets).second;
+        recordPartition(statistics, imbalance, imbalance > factor);
+    }
+
     // Compute which bucket can cause overflow
     const int overflow_bucket = computeOverflowBucket();
 
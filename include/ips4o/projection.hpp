@@ -0,0 +1,140 @@
+/******************************************************************************
+ * include/ips4o/projection.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace ips4o {
+
+/**
+ * Projection which returns its argument unchanged.
+ */
+struct identity {
+    template <class T>
+    constexpr T&& operator()(T&& t) const noexcept {
+        return std::forward<T>(t);
+    }
+};
+
+namespace detail {
+
+/**
+ * Compares values by comparing their projected keys.
+ */
+template <class Comp, class Proj>
+class ProjectedLess {
+ public:
+    ProjectedLess(Comp comp, Proj proj)
+        : comp_(std::move(comp)), proj_(std::move(proj)) {}
+
+    template <class T, class U>
+    bool operator()(const T& lhs, const U& rhs) const {
+        return comp_(proj_(lhs), proj_(rhs));
+    }
+
+    const Comp& keyLess() const { return comp_; }
+
+    const Proj& projection() const { return proj_; }
+
+ private:
+    Comp comp_;
+    Proj proj_;
+};
+
+/**
+ * Splits a comparator on values into a comparator on keys and a projection.
+ * Plain comparators compare the values themselves.
+ */
+template <class Less>
+struct Projection {
+    using key_less = Less;
+
+    static const key_less& keyLess(const Less& comp) { return comp; }
+
+    template <class T>
+    static const T& key(const Less&, const T& value) {
+        return value;
+    }
+
+    static constexpr const bool kIsIdentity = true;
+};
+
+template <class Comp, class Proj>
+struct Projection<ProjectedLess<Comp, Proj>> {
+    using key_less = Comp;
+
+    static const key_less& keyLess(const ProjectedLess<Comp, Proj>& comp) {
+        return comp.keyLess();
+    }
+
+    template <class T>
+    static decltype(auto) key(const ProjectedLess<Comp, Proj>& comp, const T& value) {
+        return comp.projection()(value);
+    }
+
+    static constexpr const bool kIsIdentity = std::is_same<Proj, identity>::value;
+};
+
+/**
+ * Holds the projected key of an element.
+ * Keys returned by reference are not copied.
+ */
+template <class Ref, bool = std::is_lvalue_reference<Ref>::value>
+class KeyHolder {
+ public:
+    void set(Ref key) { ptr_ = std::addressof(key); }
+
+    Ref get() const { return *ptr_; }
+
+ private:
+    std::remove_reference_t<Ref>* ptr_;
+};
+
+template <class Ref>
+class KeyHolder<Ref, false> {
+ public:
+    void set(Ref&& key) { key_ = std::forward<Ref>(key); }
+
+    const std::decay_t<Ref>& get() const { return key_; }
+
+ private:
+    std::decay_t<Ref> key_;
+};
+
+}  // namespace detail
+}  // namespace ips4o
@@ -0,0 +1,168 @@
+/******************************************************************************
+ * include/ips4o/radix.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "ips4o_fwd.hpp"
+#include "classifier.hpp"
+#include "config.hpp"
+#include "memory.hpp"
+#include "utils.hpp"
+
+namespace ips4o {
+namespace detail {
+
+/**
+ * Computes the bits in which the keys of [begin, end) differ.
+ * Returns 0 if all keys are equal or if this is not a radix sorter.
+ */
+template <class Cfg>
+template <bool kIsParallel>
+std::uint64_t Sorter<Cfg>::radixDifference(const iterator begin, const iterator end,
+                                           const int my_id, const int num_threads) {
+    return radixDifference<kIsParallel>(
+            begin, end, my_id, num_threads,
+            std::integral_constant<bool, Cfg::kRadixSort>{});
+}
+
+template <class Cfg>
+template <bool kIsParallel>
+std::uint64_t Sorter<Cfg>::radixDifference(iterator, iterator, int, int,
+                                           std::false_type) {
+    return 0;
+}
+
+template <class Cfg>
+template <bool kIsParallel>
+std::uint64_t Sorter<Cfg>::radixDifference(const iterator begin, const iterator end,
+                                           const int my_id, const int num_threads,
+                                           std::true_type) {
+    using Key = RadixKey<typename Cfg::key_type>;
+    const auto n = end - begin;
+
+    // Radix classification is only used if there is at least one more level
+    if (n <= Cfg::kSingleLevelThreshold) return ~std::uint64_t{0};
+
+    const auto& classifier = kIsParallel ? shared_->classifier : local_.classifier;
+    const auto first = Key::toUnsigned(classifier.key(*begin));
+    const auto my_begin = begin + n * my_id / num_threads;
+    const auto my_end = begin + n * (my_id + 1) / num_threads;
+
+    typename Key::unsigned_type diff = 0;
+    for (auto it = my_begin; it != my_end; ++it)
+        diff |= Key::toUnsigned(classifier.key(*it)) ^ first;
+
+    if (!kIsParallel) return diff;
+
+    __atomic_fetch_or(&shared_->radix_difference, diff, __ATOMIC_RELAXED);
+    shared_->sync.barrier();
+    return __atomic_load_n(&shared_->radix_difference, __ATOMIC_RELAXED);
+}
+
+/**
+ * Builds a radix classifier for the highest digit in which keys differ, or falls
+ * back to the sample sort classifier for small or skewed inputs.
+ */
+template <class Cfg>
+std::pair<int, bool> Sorter<Cfg>::buildRadixClassifier(const iterator begin,
+                                                       const iterator end,
+                                                       const std::uint64_t diff,
+                                                       Classifier& classifier) {
+    const int num_buckets = radixClassifier(begin, end, diff, classifier);
+    if (num_buckets > 0) return {num_buckets, false};
+    return buildClassifier(begin, end, classifier);
+}
+
+/**
+ * Sets up radix classification for the highest digit in which keys differ.
+ * Returns the number of buckets, or zero if the sample sort classifier should be used.
+ */
+template <class Cfg>
+int Sorter<Cfg>::radixClassifier(const iterator begin, const iterator end,
+                                 const std::uint64_t diff, Classifier& classifier) {
+    return radixClassifier(begin, end, diff, classifier,
+                           std::integral_constant<bool, Cfg::kRadixSort>{});
+}
+
+template <class Cfg>
+int Sorter<Cfg>::radixClassifier(iterator, iterator, std::uint64_t, Classifier&,
+                                 std::false_type) {
+    return 0;
+}
+
+template <class Cfg>
+int Sorter<Cfg>::radixClassifier(const iterator begin, const iterator end,
+                                 const std::uint64_t diff, Classifier& classifier,
+                                 std::true_type) {
+    const auto n = end - begin;
+    if (n <= Cfg::kSingleLevelThreshold) return 0;
+
+    // Take the digit just below the highest differing bit; all keys share the bits
+    // above, so levels on which all keys have the same digit are skipped.
+    IPS4OML_ASSUME_NOT(diff == 0);
+    const int high_bit =
+            std::numeric_limits<std::uint64_t>::digits - 1 - __builtin_clzll(diff);
+    const int log_buckets =
+            std::min({Cfg::kLogBuckets, local_.max_log_buckets, high_bit + 1});
+    const int shift = high_bit + 1 - log_buckets;
+    const int num_buckets = 1 << log_buckets;
+    classifier.buildRadix(shift, log_buckets);
+
+    // Estimate the digit histogram from an evenly spaced sample
+    const diff_t num_samples = std::min<diff_t>(n, 4 * num_buckets);
+    const diff_t step = n / num_samples;
+    diff_t histogram[Cfg::kMaxBuckets] = {};
+    for (diff_t i = 0; i < num_samples; ++i)
+        ++histogram[classifier.template classify<false>(begin[i * step])];
+    const diff_t max_bucket = *std::max_element(histogram, histogram + num_buckets);
+
+    // Skewed digits would leave most elements in a single bucket, use sample sort
+    if (max_bucket * 100 > Cfg::kRadixSkewPercent * num_samples) {
+        classifier.reset();
+        return 0;
+    }
+
+    this->classifier_ = &classifier;
+    return num_buckets;
+}
+
+}  // namespace detail
+}  // namespace ips4o
@@ -35,14 +35,18 @@
 
 #pragma once
 
+#include <algorithm>
 #include <iterator>
 #include <random>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include "ips4o_fwd.hpp"
 #include "classifier.hpp"
 #include "config.hpp"
 #include "memory.hpp"
+#include "splitter_cache.hpp"
 
 namespace ips4o {
 namespace detail {
@@ -65,6 +69,19 @@ void selectSample(It begin, const It end,
     }
 }
 
+/**
+ * Number of buckets, samples per bucket and total number of samples for an input
+ * of size n, using at most 2^max_log_buckets buckets.
+ */
+template <class Cfg>
+std::tuple<int, typename Cfg::difference_type, typename Cfg::difference_type>
+Sorter<Cfg>::sampleParameters(const diff_t n, const int max_log_buckets) {
+    const int log_buckets = std::min<int>(Cfg::logBuckets(n), max_log_buckets);
+    const diff_t step = std::max<diff_t>(1, Cfg::oversamplingFactor(n));
+    const diff_t num_samples = std::min(step * (diff_t{1} << log_buckets) - 1, n / 2);
+    return std::make_tuple(log_buckets, step, num_samples);
+}
+
 /**
  * Builds the classifer.
  * Number of used_buckets is a power of two and at least two.
@@ -73,44 +90,262 @@ template <class Cfg>
 std::pair<int, bool> Sorter<Cfg>::buildClassifier(const iterator begin,
                                                   const iterator end,
                                                   Classifier& classifier) {
+    int log_buckets;
+    diff_t step, num_samples;
+    std::tie(log_buckets, step, num_samples) =
+            sampleParameters(end - begin, local_.max_log_buckets);
+
+    // Take the sample requests of the recursion, sorting the sample recurses as well
+    auto& stack = local_.sample_stack;
+    const diff_t inherited_begin = local_.inherited_begin;
+    const diff_t inherited = local_.inherited_end - inherited_begin;
+    diff_t* const sample_start = local_.sample_start;
+    local_.inherited_begin = local_.inherited_end = 0;
+    local_.sample_start = nullptr;
+
+    const auto key = [&classifier](const value_type& v) -> typename Cfg::key_reference {
+        return classifier.key(v);
+    };
+
+    if (4 * inherited < num_samples) {
+        // Select the sample
+        detail::selectSample(begin, end, num_samples, local_.random_generator);
+
+        // Sort the sample
+        sequential(begin, begin + num_samples);
+
+        const auto res = buildClassifierFromSample(begin, begin + num_samples,
+                                                   log_buckets, step, key, classifier);
+
+        // Keep the sorted sample for the next level
+        if (sample_start) {
+            const diff_t sample_begin = stack.size();
+            for (auto it = begin; it != begin + num_samples; ++it)
+                stack.push_back(key(*it));
+            splitSample(sample_begin, res.first, res.second, classifier, sample_start);
+        }
+        return res;
+    }
+
+    // The parent step sampled this range well enough. Only draw the missing samples
+    // and merge them with the inherited ones on top of the stack.
+    const diff_t num_fresh = std::max<diff_t>(0, num_samples - inherited);
+    detail::selectSample(begin, end, num_fresh, local_.random_generator);
+    sequential(begin, begin + num_fresh);
+
+    const auto& comp = classifier.keyLess();
+    const diff_t sample_begin = stack.size();
+    // No reallocation while merging, so that the inherited samples stay in place
+    stack.reserve(sample_begin + inherited + num_fresh);
+    auto inherited_it = stack.cbegin() + inherited_begin;
+    const auto inherited_end = inherited_it + inherited;
+    auto fresh = begin;
+    const auto fresh_end = begin + num_fresh;
+    while (inherited_it != inherited_end || fresh != fresh_end) {
+        if (fresh == fresh_end
+            || (inherited_it != inherited_end && !comp(key(*fresh), *inherited_it)))
+            stack.push_back(*inherited_it++);
+        else
+            stack.push_back(key(*fresh++));
+    }
+
+    // Use an evenly spaced subset if more samples were inherited than needed
+    const diff_t size = stack.size() - sample_begin;
+    step = std::max<diff_t>(1, (size + 1) >> log_buckets);
+    const diff_t used = std::min(size, (step << log_buckets) - 1);
+    const auto sample = stack.begin() + sample_begin + (size - used) / 2;
+    const auto res = buildClassifierFromSample(
+            sample, sample + used, log_buckets, step,
+            [](const typename Cfg::key_type& key) -> const typename Cfg::key_type& {
+                return key;
+            },
+            classifier);
+
+    if (sample_start)
+        splitSample(sample_begin, res.first, res.second, classifier, sample_start);
+    else
+        stack.erase(stack.begin() + sample_begin, stack.end());
+    return res;
+}
+
+/**
+ * Stores where the part of the sorted sample on top of the sample stack which falls
+ * into each bucket starts. The sample starts at sample_begin.
+ */
+template <class Cfg>
+void Sorter<Cfg>::splitSample(const diff_t sample_begin, const int num_buckets,
+                              const bool equal_buckets, Classifier& classifier,
+                              diff_t* const sample_start) {
+    const auto& stack = local_.sample_stack;
+    const auto& comp = classifier.keyLess();
+    const auto splitters = classifier.getSortedSplitters();
+    const int step = 1 + equal_buckets;
+    const int num_splitters = num_buckets / step - 1;
+
+    // Bucket i holds the keys greater than splitter i - 1 and not greater than
+    // splitter i, its equality bucket the keys equal to splitter i. Keys greater than
+    // the last splitter go to the last bucket.
+    auto it = stack.begin() + sample_begin;
+    for (int i = 0; i < num_splitters; ++i) {
+        sample_start[step * i] = it - stack.begin();
+        if (equal_buckets) {
+            it = std::lower_bound(it, stack.end(), splitters[i], comp);
+            sample_start[step * i + 1] = it - stack.begin();
+        }
+        it = std::upper_bound(it, stack.end(), splitters[i], comp);
+    }
+    for (int i = step * num_splitters; i < num_buckets; ++i)
+        sample_start[i] = it - stack.begin();
+    sample_start[num_buckets] = stack.size();
+}
+
+/**
+ * Draws the sample for the shared classifier with all threads. Each thread takes its
+ * share of the samples from its own stripe and sorts them. The sorted parts are then
+ * merged pairwise, leaving the whole sample in the local data of the first thread.
+ * The input is not modified.
+ */
+template <class Cfg>
+void Sorter<Cfg>::parallelSample(const iterator begin, const iterator end,
+                                 const diff_t num_samples, const int my_id,
+                                 const int num_threads) {
+    const auto& classifier = shared_->classifier;
+    const auto& comp = classifier.keyLess();
+    auto& sample = local_.sample;
+
+    // Draw with replacement, so that no elements have to be moved
     const auto n = end - begin;
-    int log_buckets = Cfg::logBuckets(n);
-    int num_buckets = 1 << log_buckets;
-    const auto step = std::max<diff_t>(1, Cfg::oversamplingFactor(n));
-    const auto num_samples = std::min(step * num_buckets - 1, n / 2);
+    const diff_t my_begin = n * my_id / num_threads;
+    const diff_t my_end = n * (my_id + 1) / num_threads;
+    const diff_t my_samples = num_samples * (my_id + 1) / num_threads
+                              - num_samples * my_id / num_threads;
+    sample.clear();
+    if (my_samples > 0) {
+        std::uniform_int_distribution<diff_t> dist(my_begin, my_end - 1);
+        sample.reserve(my_samples);
+        for (diff_t i = 0; i < my_samples; ++i)
+            sample.push_back(classifier.key(begin[dist(local_.random_generator)]));
+        std::sort(sample.begin(), sample.end(), comp);
+    }
 
-    // Select the sample
-    detail::selectSample(begin, end, num_samples, local_.random_generator);
+    // Merge pairwise, each round halves the number of sorted parts
+    for (int distance = 1; distance < num_threads; distance *= 2) {
+        shared_->sync.barrier();
+        if (my_id % (2 * distance) == 0 && my_id + distance < num_threads) {
+            auto& other = shared_->local[my_id + distance]->sample;
+            decltype(local_.sample) merged(sample.get_allocator());
+            merged.reserve(sample.size() + other.size());
+            std::merge(std::make_move_iterator(sample.begin()),
+                       std::make_move_iterator(sample.end()),
+                       std::make_move_iterator(other.begin()),
+                       std::make_move_iterator(other.end()), std::back_inserter(merged),
+                       comp);
+            sample.swap(merged);
+            other.clear();
+        }
+    }
+    shared_->sync.barrier();
+}
 
-    // Sort the sample
-    sequential(begin, begin + num_samples);
-    auto splitter = begin + step - 1;
+/**
+ * Chooses the splitters from a sorted sample and builds the tree.
+ * Keys which fill a bucket of the sample get their own equality bucket.
+ */
+template <class Cfg>
+template <class SampleIt, class Key>
+std::pair<int, bool> Sorter<Cfg>::buildClassifierFromSample(
+        const SampleIt sample_begin, const SampleIt sample_end, int log_buckets,
+        const diff_t step, Key&& key, Classifier& classifier) {
+    using key_type = typename Cfg::key_type;
+    const auto num_samples = sample_end - sample_begin;
+    int num_buckets = 1 << log_buckets;
     auto sorted_splitters = classifier.getSortedSplitters();
-    const auto comp = classifier.getComparator();
+    const auto& comp = classifier.keyLess();
+
+    // End of the run of samples with the same key
+    const auto runEnd = [&](SampleIt run) {
+        auto it = run + 1;
+        while (it != sample_end && !comp(key(*run), key(*it))) ++it;
+        return it;
+    };
+
+    // Find heavy hitters, i.e., keys which fill at least one bucket of the sample
+    int num_heavy = 0;
+    diff_t heavy_samples = 0;
+    if (Cfg::kAllowEqualBuckets) {
+        for (auto run = sample_begin; run != sample_end;) {
+            const auto run_end = runEnd(run);
+            if (run_end - run >= step) {
+                ++num_heavy;
+                heavy_samples += run_end - run;
+            }
+            run = run_end;
+        }
+    }
 
     // Choose the splitters
     IPS4OML_ASSUME_NOT(sorted_splitters == nullptr);
-    new (sorted_splitters) typename Cfg::value_type(*splitter);
-    for (int i = 2; i < num_buckets; ++i) {
-        splitter += step;
-        // Skip duplicates
-        if (comp(*sorted_splitters, *splitter)) {
-            IPS4OML_ASSUME_NOT(sorted_splitters + 1 == nullptr);
-            new (++sorted_splitters) typename Cfg::value_type(*splitter);
+    if (num_heavy == 0) {
+        auto splitter = sample_begin + step - 1;
+        new (sorted_splitters) key_type(key(*splitter));
+        for (int i = 2; i < num_buckets; ++i) {
+            splitter += step;
+            // Skip duplicates
+            if (comp(*sorted_splitters, key(*splitter))) {
+                IPS4OML_ASSUME_NOT(sorted_splitters + 1 == nullptr);
+                new (++sorted_splitters) key_type(key(*splitter));
+            }
+        }
+    } else {
+        // Each heavy hitter becomes a splitter whose equality bucket holds all its
+        // elements. The remaining splitters divide the other samples evenly.
+        const int num_light = num_buckets - 1 - num_heavy;
+        const auto light_samples = num_samples - heavy_samples;
+        diff_t light_seen = 0;
+        int light_chosen = 0;
+        bool first = true;
+        const auto choose = [&](SampleIt splitter) {
+            if (first) {
+                new (sorted_splitters) key_type(key(*splitter));
+                first = false;
+            } else if (comp(*sorted_splitters, key(*splitter))) {
+                IPS4OML_ASSUME_NOT(sorted_splitters + 1 == nullptr);
+                new (++sorted_splitters) key_type(key(*splitter));
+            }
+        };
+        for (auto run = sample_begin; run != sample_end;) {
+            const auto run_end = runEnd(run);
+            if (run_end - run >= step) {
+                choose(run);
+            } else {
+                for (auto it = run; it != run_end; ++it) {
+                    ++light_seen;
+                    if (light_chosen < num_light
+                        && light_seen * (num_light + 1)
+                                   >= (light_chosen + 1) * light_samples) {
+                        ++light_chosen;
+                        choose(it);
+                    }
+                }
+            }
+            run = run_end;
         }
     }
 
     // Check for duplicate splitters
     const auto diff_splitters = sorted_splitters - classifier.getSortedSplitters() + 1;
-    const bool use_equal_buckets = Cfg::kAllowEqualBuckets
-            && num_buckets - 1 - diff_splitters >= Cfg::kEqualBucketsThreshold;
+    const bool use_equal_buckets =
+            Cfg::kAllowEqualBuckets
+            && (num_heavy > 0
+                || num_buckets - 1 - diff_splitters >= Cfg::kEqualBucketsThreshold);
 
     // Fill the array to the next power of two
     log_buckets = log2(diff_splitters) + 1;
     num_buckets = 1 << log_buckets;
     for (int i = diff_splitters + 1; i < num_buckets; ++i) {
         IPS4OML_ASSUME_NOT(sorted_splitters + 1 == nullptr);
-        new (++sorted_splitters) typename Cfg::value_type(*splitter);
+        new (sorted_splitters + 1) key_type(*sorted_splitters);
+        ++sorted_splitters;
     }
 
     // Build the tree
@@ -121,5 +356,27 @@ std::pair<int, bool> Sorter<Cfg>::buildClassifier(const iterator begin,
     return {used_buckets, use_equal_buckets};
 }
 
+/**
+ * Builds the classifier from splitters kept by a reusable sorter.
+ */
+template <class Cfg>
+std::pair<int, bool> Sorter<Cfg>::buildClassifier(const SplitterCache<Cfg>& cache,
+                                                  Classifier& classifier) {
+    using key_type = typename Cfg::key_type;
+    const int log_buckets = cache.logBuckets();
+    const int num_buckets = 1 << log_buckets;
+
+    auto sorted_splitters = classifier.getSortedSplitters();
+    IPS4OML_ASSUME_NOT(sorted_splitters == nullptr);
+    for (int i = 0; i < num_buckets - 1; ++i)
+        new (sorted_splitters + i) key_type(cache.splitters()[i]);
+
+    classifier.build(log_buckets);
+    this->classifier_ = &classifier;
+
+    const bool use_equal_buckets = Cfg::kAllowEqualBuckets && cache.equalBuckets();
+    return {num_buckets * (1 + use_equal_buckets), use_equal_buckets};
+}
+
 }  // namespace detail
 }  // namespace ips4o
@@ -35,139 +35,243 @@
 
 #pragma once
 
-#include <algorithm>
 #include <atomic>
-#include <cassert>
 #include <cstddef>
-#include <numeric>
-#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
 
-#if !defined(IPS4O_SEQUENTIAL)
-#include <tbb/concurrent_queue.h>
-#endif
+#include "memory_resource.hpp"
+#include "synchronization.hpp"
 
 namespace ips4o {
 namespace detail {
 
+/**
+ * Chase-Lev work-stealing deque. The owner pushes and pops at the bottom, other
+ * threads steal the oldest element from the top. Elements must be trivially copyable
+ * and are stored as atomic words. The array is allocated by the first push and
+ * doubles when full. Replaced arrays are kept until destruction, as thieves may
+ * still read from them.
+ */
 template <class T>
-class PrivateQueue {
- public:
-    PrivateQueue(size_t init_size = ((1ul << 12) + sizeof(T) - 1) / sizeof(T))
-        : m_v(), m_off(0)
-    {
-        // Preallocate memory. By default, the vector covers at least one page.
-        m_v.reserve(init_size);
-    }
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Elements of the deque must be trivially copyable.");
 
-    template <class Iterator>
-    void push(Iterator begin, Iterator end) {
-        m_v.insert(m_v.end(), begin, end);
-    }
+    using Word = std::uint64_t;
+    static constexpr std::size_t kWords = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
 
-    template <class T1>
-    void push(const T1&& e) {
-        m_v.emplace_back(std::forward(e));
-    }
+    struct Array {
+        using Slot = std::atomic<Word>;
 
-    template <typename... Args>
-    void emplace(Args... args) {
-        m_v.emplace_back(args...);
-    }
+        std::int64_t mask;
+        Array* replaced;
 
-    size_t size() const { return m_v.size() - m_off; }
+        explicit Array(std::int64_t capacity, Array* replaced)
+            : mask(capacity - 1), replaced(replaced) {
+            for (std::size_t i = 0; i != capacity * kWords; ++i) new (words() + i) Slot(0);
+        }
 
-    bool empty() const { return size() == 0; }
+        static std::size_t bytes(std::int64_t capacity) {
+            return sizeof(Array) + capacity * kWords * sizeof(Slot);
+        }
 
-    T popBack() {
-        assert(m_v.size() > m_off);
+        Slot* words() { return reinterpret_cast<Slot*>(this + 1); }
 
-        const T e = m_v.back();
-        m_v.pop_back();
+        void put(const std::int64_t i, const T& e) {
+            Word w[kWords] = {};
+            std::memcpy(w, &e, sizeof(T));
+            auto* slot = words() + (i & mask) * kWords;
+            for (std::size_t k = 0; k != kWords; ++k)
+                slot[k].store(w[k], std::memory_order_relaxed);
+        }
 
-        if (m_v.size() == m_off) {
-            clear();
+        T get(const std::int64_t i) {
+            Word w[kWords];
+            auto* slot = words() + (i & mask) * kWords;
+            for (std::size_t k = 0; k != kWords; ++k)
+                w[k] = slot[k].load(std::memory_order_relaxed);
+            T e;
+            std::memcpy(&e, w, sizeof(T));
+            return e;
         }
+    };
 
-        return e;
+    // The first array covers at least one page
+    static constexpr std::int64_t initialCapacity() {
+        std::int64_t capacity = 1;
+        while (capacity * kWords * sizeof(Word) < 4096) capacity *= 2;
+        return capacity;
+    }
+
+ public:
+    explicit WorkStealingDeque(memory_resource* resource = get_default_resource())
+        : resource_(resource), array_(nullptr), top_(0), bottom_(0) {}
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    ~WorkStealingDeque() {
+        for (auto* a = array_.load(std::memory_order_relaxed); a != nullptr;) {
+            auto* const replaced = a->replaced;
+            const auto capacity = a->mask + 1;
+            a->~Array();
+            resource_->deallocate(a, Array::bytes(capacity), alignof(Array));
+            a = replaced;
+        }
     }
 
-    T popFront() {
-        assert(m_v.size() > m_off);
+    /**
+     * Pushes an element at the bottom. Only called by the owner.
+     */
+    void push(const T& e) {
+        const auto b = bottom_.load(std::memory_order_relaxed);
+        const auto t = top_.load(std::memory_order_acquire);
+        auto* a = array_.load(std::memory_order_relaxed);
+        if (a == nullptr || b - t > a->mask) a = grow(a, t, b);
+        a->put(b, e);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
 
-        const T e = m_v[m_off];
-        ++m_off;
+    template <typename... Args>
+    void emplace(Args... args) {
+        push(T(args...));
+    }
 
-        if (m_v.size() == m_off) {
-            clear();
+    /**
+     * Pops the newest element. Only called by the owner.
+     */
+    bool pop(T& e) {
+        const auto b = bottom_.load(std::memory_order_relaxed) - 1;
+        auto* const a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_seq_cst);
+        auto t = top_.load(std::memory_order_seq_cst);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
         }
+        e = a->get(b);
+        if (t == b) {
+            // Last element, race against thieves
+            const bool won = top_.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
 
-        return e;
+    /**
+     * Steals the oldest element. Fails if the deque is empty or another thread took
+     * the element first.
+     */
+    bool steal(T& e) {
+        auto t = top_.load(std::memory_order_seq_cst);
+        const auto b = bottom_.load(std::memory_order_seq_cst);
+        if (t >= b) return false;
+
+        e = array_.load(std::memory_order_acquire)->get(t);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
     }
 
-    void clear() {
-        m_off = 0;
-        m_v.clear();
+    /**
+     * Number of elements. Only exact if no other thread modifies the deque.
+     */
+    std::size_t size() const {
+        const auto b = bottom_.load(std::memory_order_relaxed);
+        const auto t = top_.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
     }
 
- protected:
-    std::vector<T> m_v;
-    size_t m_off;
+    bool empty() const { return size() == 0; }
+
+ private:
+    Array* grow(Array* a, const std::int64_t t, const std::int64_t b) {
+        const auto capacity = a == nullptr ? initialCapacity() : 2 * (a->mask + 1);
+        auto* const bigger =
+                new (resource_->allocate(Array::bytes(capacity), alignof(Array)))
+                        Array(capacity, a);
+        for (auto i = t; i != b; ++i) bigger->put(i, a->get(i));
+        array_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    memory_resource* const resource_;
+    std::atomic<Array*> array_;
+    std::atomic<std::int64_t> top_;
+    std::atomic<std::int64_t> bottom_;
 };
 
+/**
+ * Distributes jobs between the deques of the threads. Each thread processes its own
+ * jobs newest first. An idle thread steals the oldest job of the fullest deque. The
+ * threads are done as soon as all of them are idle, as only busy threads add jobs.
+ */
 template <class Job>
 class Scheduler {
  public:
     Scheduler(size_t num_threads) : m_num_idle_threads(0), m_num_threads(num_threads) {}
 
 #if !defined(IPS4O_SEQUENTIAL)
-    bool getJob(PrivateQueue<Job>& my_queue, Job& j) {
+    /**
+     * Gets the next job of thread my_id, where queue_of(i) returns the deque of
+     * thread i. Returns false if all threads are out of jobs.
+     */
+    template <class QueueOf>
+    bool getJob(const int my_id, QueueOf&& queue_of, Job& j) {
         // Try to get local job.
-        if (!my_queue.empty()) {
-            j = my_queue.popBack();
-            return true;
-        }
+        if (queue_of(my_id).pop(j)) return true;
 
-        // Try to get global job.
-        const bool succ = m_glob_queue.try_pop(j);
-        if (succ) return succ;
+        // Try to steal a job.
+        int victim = findVictim(my_id, queue_of);
+        if (victim != -1 && queue_of(victim).steal(j)) return true;
 
         // Signal idle.
-        m_num_idle_threads.fetch_add(1, std::memory_order_relaxed);
-
-        while (m_num_idle_threads.load(std::memory_order_relaxed) != m_num_threads) {
-            if (!m_glob_queue.empty()) {
-                m_num_idle_threads.fetch_sub(1, std::memory_order_relaxed);
-
-                const bool succ = m_glob_queue.try_pop(j);
-                if (succ) {
-                    return succ;
-                }
-
-                m_num_idle_threads.fetch_add(1, std::memory_order_relaxed);
+        m_num_idle_threads.fetch_add(1, std::memory_order_acq_rel);
+
+        while (m_num_idle_threads.load(std::memory_order_acquire) != m_num_threads) {
+            victim = findVictim(my_id, queue_of);
+            if (victim != -1) {
+                // Busy while holding a stolen job
+                m_num_idle_threads.fetch_sub(1, std::memory_order_acq_rel);
+                if (queue_of(victim).steal(j)) return true;
+                m_num_idle_threads.fetch_add(1, std::memory_order_acq_rel);
             }
+            cpuRelax();
         }
 
         return false;
     }
-
-    void offerJob(PrivateQueue<Job>& my_queue) {
-        if (my_queue.size() > 1 && m_num_idle_threads.load(std::memory_order_relaxed) > 0
-            && m_glob_queue.empty()) {
-            addJob(my_queue.popFront());
-        }
-    }
-
-    void addJob(const Job& j) { m_glob_queue.push(j); }
-
-    void addJob(const Job&& j) { m_glob_queue.push(j); }
 #endif
 
     void reset() { m_num_idle_threads.store(0, std::memory_order_relaxed); }
 
  protected:
 #if !defined(IPS4O_SEQUENTIAL)
-    tbb::concurrent_queue<Job> m_glob_queue;
+    /**
+     * Returns the thread with the most queued jobs, or -1 if all deques are empty.
+     */
+    template <class QueueOf>
+    int findVictim(const int my_id, QueueOf& queue_of) const {
+        int victim = -1;
+        std::size_t most = 0;
+        for (std::size_t i = 1; i != m_num_threads; ++i) {
+            const int id = static_cast<int>((my_id + i) % m_num_threads);
+            const auto size = queue_of(id).size();
+            if (size > most) {
+                most = size;
+                victim = id;
+            }
+        }
+        return victim;
+    }
 #endif
+
     std::atomic_uint64_t m_num_idle_threads;
     const size_t m_num_threads;
 };
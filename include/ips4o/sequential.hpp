@@ -40,8 +40,11 @@
 #include "ips4o_fwd.hpp"
 #include "base_case.hpp"
 #include "memory.hpp"
+#include "memory_resource.hpp"
+#include "natural_runs.hpp"
 #include "partitioning.hpp"
 #include "scheduler.hpp"
+#include "splitter_cache.hpp"
 
 namespace ips4o {
 namespace detail {
@@ -53,7 +56,7 @@ namespace detail {
  */
 template <class Cfg>
 void Sorter<Cfg>::sequential(const iterator begin, const Task& task,
-                             PrivateQueue<Task>& queue) {
+                             WorkStealingDeque<Task>& queue) {
     // Check for base case
     const auto n = task.end - task.begin;
     IPS4OML_IS_NOT(n <= 2 * Cfg::kBaseCaseSize);
@@ -79,9 +82,22 @@ void Sorter<Cfg>::sequential(const iterator begin, const Task& task,
             queue.emplace(task.begin + start, task.begin + stop);
         }
     }
+
+    // The task of an oversized bucket is popped first, the others can be stolen
+    const auto largest = largestBucket(bucket_start, num_buckets, equal_buckets);
+    const std::uint64_t factor = Cfg::kImbalanceFactorPercent;
+    const int imbalanced_bucket = largest.second > factor ? largest.first : -1;
+
     for (int i = num_buckets - 1 - equal_buckets; i >= 0; i -= 1 + equal_buckets) {
         const auto start = bucket_start[i];
         const auto stop = bucket_start[i + 1];
+        if (stop - start > 2 * Cfg::kBaseCaseSize && i != imbalanced_bucket) {
+            queue.emplace(task.begin + start, task.begin + stop);
+        }
+    }
+    if (imbalanced_bucket != -1) {
+        const auto start = bucket_start[imbalanced_bucket];
+        const auto stop = bucket_start[imbalanced_bucket + 1];
         if (stop - start > 2 * Cfg::kBaseCaseSize) {
             queue.emplace(task.begin + start, task.begin + stop);
         }
@@ -127,11 +143,21 @@ void Sorter<Cfg>::sequential_rec(const iterator begin, const iterator end) {
 
     diff_t bucket_start[Cfg::kMaxBuckets + 1];
 
+    // Keep the sample of this step for the next level
+    diff_t sample_start[Cfg::kMaxBuckets + 1];
+    const auto stack_size = local_.sample_stack.size();
+    if (n > Cfg::kSingleLevelThreshold) local_.sample_start = sample_start;
+
     // Do the partitioning
     const auto res = partition<false>(begin, end, bucket_start, 0, 1);
     const int num_buckets = std::get<0>(res);
     const bool equal_buckets = std::get<1>(res);
 
+    // Kept splitters, radix digits and sorted input need no sample
+    const bool has_sample = local_.sample_start == nullptr;
+    local_.sample_start = nullptr;
+    local_.inherited_begin = local_.inherited_end = 0;
+
     // Final base case is executed in cleanup step, so we're done here
     if (n <= Cfg::kSingleLevelThreshold) {
         return;
@@ -141,19 +167,23 @@ void Sorter<Cfg>::sequential_rec(const iterator begin, const iterator end) {
     g_ips4o_level++;
 #endif
 
-    // Recurse
-    for (int i = 0; i < num_buckets; i += 1 + equal_buckets) {
+    // Recurse, each bucket inherits its part of the sample
+    const auto recurse = [&](const int i) {
         const auto start = bucket_start[i];
         const auto stop = bucket_start[i + 1];
-        if (stop - start > 2 * Cfg::kBaseCaseSize)
-            sequential(begin + start, begin + stop);
-    }
-    if (equal_buckets) {
-        const auto start = bucket_start[num_buckets - 1];
-        const auto stop = bucket_start[num_buckets];
-        if (stop - start > 2 * Cfg::kBaseCaseSize)
+        if (stop - start > 2 * Cfg::kBaseCaseSize) {
+            if (has_sample) {
+                local_.inherited_begin = sample_start[i];
+                local_.inherited_end = sample_start[i + 1];
+            }
             sequential(begin + start, begin + stop);
-    }
+        }
+    };
+    for (int i = 0; i < num_buckets; i += 1 + equal_buckets) recurse(i);
+    if (equal_buckets) recurse(num_buckets - 1);
+
+    auto& stack = local_.sample_stack;
+    stack.erase(stack.begin() + stack_size, stack.end());
 
 #ifdef IPS4O_TIMER
     g_ips4o_level--;
@@ -172,28 +202,116 @@ class SequentialSorter {
     using iterator = typename Cfg::iterator;
 
  public:
-    explicit SequentialSorter(bool check_sorted, typename Cfg::less comp)
+    /**
+     * Construct the sorter. Buffers and local data are allocated from the resource.
+     * The buffers are allocated by the first sort which needs them and grow with the
+     * number of buckets of later sorts, within the memory budget.
+     */
+    explicit SequentialSorter(bool check_sorted, typename Cfg::less comp,
+                              memory_resource* resource = get_default_resource())
         : check_sorted_(check_sorted)
-        , buffer_storage_(1)
-        , local_ptr_(Cfg::kDataAlignment, std::move(comp), buffer_storage_.get()) {}
-
+        , resource_(resource)
+        , splitter_cache_(resource)
+        , local_ptr_(resource, Cfg::kDataAlignment, std::move(comp), nullptr, 0,
+                     resource) {}
+
+    /**
+     * Construct the sorter with buffers of Sorter::BufferStorage::kPerThread bytes.
+     */
     explicit SequentialSorter(bool check_sorted, typename Cfg::less comp,
-                              char* buffer_storage)
+                              char* buffer_storage,
+                              memory_resource* resource = get_default_resource())
         : check_sorted_(check_sorted)
-        , local_ptr_(Cfg::kDataAlignment, std::move(comp), buffer_storage) {}
+        , resource_(resource)
+        , buffer_buckets_(Cfg::kMaxBuckets)
+        , splitter_cache_(resource)
+        , local_ptr_(resource, Cfg::kDataAlignment, std::move(comp), buffer_storage, 0,
+                     resource) {}
+
+    /**
+     * Keeps the top-level splitters of a sort for the next sorts. Kept or supplied
+     * splitters are dropped as soon as the largest bucket of a sort holds more than
+     * max_imbalance times the average, and the next sort samples again.
+     */
+    void reuse_splitters(const bool enable, const double max_imbalance = 4.0) {
+        splitter_cache_.setReuse(enable, max_imbalance);
+    }
+
+    /**
+     * Uses the given keys as top-level splitters instead of sampling. At most
+     * 2^kLogBuckets - 1 evenly spaced distinct keys are used.
+     */
+    template <class KeyIt>
+    void set_splitters(KeyIt first, KeyIt last) {
+        const auto& comp = local_ptr_.get().classifier.keyLess();
+        splitter_cache_.assign(std::move(first), std::move(last), comp);
+    }
 
     void operator()(iterator begin, iterator end) {
         if (check_sorted_) {
-            const bool sorted = detail::sortSimpleCases(
-                    begin, end, local_ptr_.get().classifier.getComparator());
+            const auto& comp = local_ptr_.get().classifier.getComparator();
+            const bool sorted = detail::sortSimpleCases(begin, end, comp)
+                                || detail::sortNaturalRuns<Cfg>(begin, end, comp, resource_);
             if (sorted) return;
         }
 
-        Sorter(local_ptr_.get()).sequential(std::move(begin), std::move(end));
+        auto& local = local_ptr_.get();
+        reserveBuffers(end - begin);
+        local.splitter_cache = &splitter_cache_;
+        local.statistics = &statistics_;
+        Sorter(local).sequential(std::move(begin), std::move(end));
+        local.splitter_cache = nullptr;
+        local.statistics = nullptr;
+    }
+
+    /**
+     * Returns the statistics of all partitioning steps since construction or the
+     * last reset.
+     */
+    const partition_statistics& statistics() const { return statistics_; }
+
+    void reset_statistics() { statistics_ = partition_statistics(); }
+
+    /**
+     * Limits the buffers to the given number of bytes by using fewer buckets, which
+     * may take more recursion levels. A budget of zero means no limit.
+     */
+    void set_memory_budget(const std::size_t bytes) { memory_budget_ = bytes; }
+
+    /**
+     * Returns the number of bytes of the buffers.
+     */
+    std::size_t buffer_bytes() const {
+        return Sorter::BufferStorage::bytesPerThread(buffer_buckets_);
     }
 
  private:
+    /**
+     * Makes sure that the buffers hold all buckets of a sort of n elements.
+     */
+    void reserveBuffers(const typename Cfg::difference_type n) {
+        auto& local = local_ptr_.get();
+        if (n <= 2 * Cfg::kBaseCaseSize) return;
+        local.max_log_buckets = Sorter::maxLogBuckets(n, memory_budget_, 1);
+        const int num_buckets = Sorter::bufferBuckets(local.max_log_buckets);
+        // Shrink own buffers which a sort before the budget was set has grown
+        const bool over_budget = memory_budget_ != 0
+                                 && num_buckets < buffer_storage_.numBuckets()
+                                 && buffer_bytes() > memory_budget_;
+        if (num_buckets <= buffer_buckets_ && !over_budget) return;
+
+        buffer_storage_ = typename Sorter::BufferStorage();
+        buffer_storage_ = typename Sorter::BufferStorage(1, resource_, num_buckets);
+        buffer_buckets_ = num_buckets;
+        local.buffers.setStorage(buffer_storage_.get());
+    }
+
     const bool check_sorted_;
+    memory_resource* const resource_;
+    std::size_t memory_budget_ = 0;
+    int buffer_buckets_ = 0;
+    detail::SplitterCache<Cfg> splitter_cache_;
+    partition_statistics statistics_;
     typename Sorter::BufferStorage buffer_storage_;
     detail::AlignedPtr<typename Sorter::LocalData> local_ptr_;
 };
@@ -0,0 +1,473 @@
+/******************************************************************************
+ * include/ips4o/simd_classifier.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace ips4o {
+namespace detail {
+
+/**
+ * Vectorized descent of the implicit splitter tree.
+ *
+ * A kernel classifies kLanes elements at once: each tree level is one gather of the
+ * current splitters followed by one vector comparison. Bucket indices are kept in
+ * lanes as wide as the key and stored as std::int32_t. The results are identical to
+ * the scalar classifier, including NaN placement.
+ */
+template <class T, class Enable = void>
+struct SimdKernel {
+    static constexpr const bool kEnabled = false;
+};
+
+/**
+ * Key categories supported by the vectorized classifier.
+ */
+template <class T>
+struct SimdKeyTraits {
+    static constexpr const bool kIsFloat = std::is_same<T, float>::value
+                                           || std::is_same<T, double>::value;
+    static constexpr const bool kIsInteger =
+            std::is_integral<T>::value && !std::is_same<T, bool>::value
+            && (sizeof(T) == 4 || sizeof(T) == 8);
+    static constexpr const bool kSupported = kIsFloat || kIsInteger;
+};
+
+#if defined(__AVX512F__)
+
+/**
+ * AVX-512 kernel for 32-bit integers.
+ */
+template <class T>
+struct SimdKernel<T, std::enable_if_t<SimdKeyTraits<T>::kIsInteger && sizeof(T) == 4>> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 16;
+    using vec = __m512i;
+    using index = __m512i;
+
+    static index init() { return _mm512_set1_epi32(1); }
+
+    static vec load(const T* p) { return _mm512_loadu_si512(p); }
+
+    static vec gather(const T* base, index b) {
+        return _mm512_i32gather_epi32(b, base, sizeof(T));
+    }
+
+    static index offset(index b, int off) {
+        return _mm512_sub_epi32(b, _mm512_set1_epi32(off));
+    }
+
+    // b = 2 * b + (s < x)
+    static index descend(index b, vec s, vec x) {
+        const __mmask16 m = std::is_signed<T>::value ? _mm512_cmpgt_epi32_mask(x, s)
+                                                     : _mm512_cmpgt_epu32_mask(x, s);
+        b = _mm512_add_epi32(b, b);
+        return _mm512_mask_add_epi32(b, m, b, _mm512_set1_epi32(1));
+    }
+
+    // b = 2 * b + !(x < s)
+    static index descendEqual(index b, vec s, vec x) {
+        const __mmask16 m = std::is_signed<T>::value ? _mm512_cmpge_epi32_mask(x, s)
+                                                     : _mm512_cmpge_epu32_mask(x, s);
+        b = _mm512_add_epi32(b, b);
+        return _mm512_mask_add_epi32(b, m, b, _mm512_set1_epi32(1));
+    }
+
+    static void store(std::int32_t* out, index b) { _mm512_storeu_si512(out, b); }
+};
+
+/**
+ * AVX-512 kernel for 64-bit integers.
+ */
+template <class T>
+struct SimdKernel<T, std::enable_if_t<SimdKeyTraits<T>::kIsInteger && sizeof(T) == 8>> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    using vec = __m512i;
+    using index = __m512i;
+
+    static index init() { return _mm512_set1_epi64(1); }
+
+    static vec load(const T* p) { return _mm512_loadu_si512(p); }
+
+    static vec gather(const T* base, index b) {
+        return _mm512_i64gather_epi64(b, base, sizeof(T));
+    }
+
+    static index offset(index b, int off) {
+        return _mm512_sub_epi64(b, _mm512_set1_epi64(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        const __mmask8 m = std::is_signed<T>::value ? _mm512_cmpgt_epi64_mask(x, s)
+                                                    : _mm512_cmpgt_epu64_mask(x, s);
+        b = _mm512_add_epi64(b, b);
+        return _mm512_mask_add_epi64(b, m, b, _mm512_set1_epi64(1));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        const __mmask8 m = std::is_signed<T>::value ? _mm512_cmpge_epi64_mask(x, s)
+                                                    : _mm512_cmpge_epu64_mask(x, s);
+        b = _mm512_add_epi64(b, b);
+        return _mm512_mask_add_epi64(b, m, b, _mm512_set1_epi64(1));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi64_epi32(b));
+    }
+};
+
+/**
+ * AVX-512 kernel for single precision floats.
+ */
+template <>
+struct SimdKernel<float, void> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 16;
+    using vec = __m512;
+    using index = __m512i;
+
+    static index init() { return _mm512_set1_epi32(1); }
+
+    static vec load(const float* p) { return _mm512_loadu_ps(p); }
+
+    static vec gather(const float* base, index b) {
+        return _mm512_i32gather_ps(b, base, sizeof(float));
+    }
+
+    static index offset(index b, int off) {
+        return _mm512_sub_epi32(b, _mm512_set1_epi32(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        const __mmask16 m = _mm512_cmp_ps_mask(s, x, _CMP_LT_OQ);
+        b = _mm512_add_epi32(b, b);
+        return _mm512_mask_add_epi32(b, m, b, _mm512_set1_epi32(1));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        const __mmask16 m = _mm512_cmp_ps_mask(x, s, _CMP_NLT_UQ);
+        b = _mm512_add_epi32(b, b);
+        return _mm512_mask_add_epi32(b, m, b, _mm512_set1_epi32(1));
+    }
+
+    static void store(std::int32_t* out, index b) { _mm512_storeu_si512(out, b); }
+};
+
+/**
+ * AVX-512 kernel for double precision floats.
+ */
+template <>
+struct SimdKernel<double, void> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    using vec = __m512d;
+    using index = __m512i;
+
+    static index init() { return _mm512_set1_epi64(1); }
+
+    static vec load(const double* p) { return _mm512_loadu_pd(p); }
+
+    static vec gather(const double* base, index b) {
+        return _mm512_i64gather_pd(b, base, sizeof(double));
+    }
+
+    static index offset(index b, int off) {
+        return _mm512_sub_epi64(b, _mm512_set1_epi64(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        const __mmask8 m = _mm512_cmp_pd_mask(s, x, _CMP_LT_OQ);
+        b = _mm512_add_epi64(b, b);
+        return _mm512_mask_add_epi64(b, m, b, _mm512_set1_epi64(1));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        const __mmask8 m = _mm512_cmp_pd_mask(x, s, _CMP_NLT_UQ);
+        b = _mm512_add_epi64(b, b);
+        return _mm512_mask_add_epi64(b, m, b, _mm512_set1_epi64(1));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi64_epi32(b));
+    }
+};
+
+#elif defined(__AVX2__)
+
+/**
+ * AVX2 kernel for 32-bit integers.
+ * Comparison results are all-ones lanes, i.e., -1, so 2 * b - cmp adds the bit.
+ */
+template <class T>
+struct SimdKernel<T, std::enable_if_t<SimdKeyTraits<T>::kIsInteger && sizeof(T) == 4>> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    using vec = __m256i;
+    using index = __m256i;
+
+    static index init() { return _mm256_set1_epi32(1); }
+
+    // Unsigned keys are compared as signed keys with flipped sign bits
+    static vec load(const T* p) {
+        return flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    }
+
+    static vec gather(const T* base, index b) {
+        return flip(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), b,
+                                           sizeof(T)));
+    }
+
+    static index offset(index b, int off) {
+        return _mm256_sub_epi32(b, _mm256_set1_epi32(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        return _mm256_sub_epi32(_mm256_add_epi32(b, b), _mm256_cmpgt_epi32(x, s));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        return _mm256_add_epi32(_mm256_add_epi32(b, b),
+                                _mm256_add_epi32(_mm256_set1_epi32(1),
+                                                 _mm256_cmpgt_epi32(s, x)));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), b);
+    }
+
+ private:
+    static vec flip(vec v) {
+        return std::is_signed<T>::value
+                       ? v
+                       : _mm256_xor_si256(v, _mm256_set1_epi32(INT32_MIN));
+    }
+};
+
+/**
+ * AVX2 kernel for 64-bit integers.
+ */
+template <class T>
+struct SimdKernel<T, std::enable_if_t<SimdKeyTraits<T>::kIsInteger && sizeof(T) == 8>> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 4;
+    using vec = __m256i;
+    using index = __m256i;
+
+    static index init() { return _mm256_set1_epi64x(1); }
+
+    static vec load(const T* p) {
+        return flip(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    }
+
+    static vec gather(const T* base, index b) {
+        return flip(_mm256_i64gather_epi64(reinterpret_cast<const long long*>(base), b,
+                                           sizeof(T)));
+    }
+
+    static index offset(index b, int off) {
+        return _mm256_sub_epi64(b, _mm256_set1_epi64x(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        return _mm256_sub_epi64(_mm256_add_epi64(b, b), _mm256_cmpgt_epi64(x, s));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        return _mm256_add_epi64(_mm256_add_epi64(b, b),
+                                _mm256_add_epi64(_mm256_set1_epi64x(1),
+                                                 _mm256_cmpgt_epi64(s, x)));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        const __m256i lo = _mm256_permutevar8x32_epi32(
+                b, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(lo));
+    }
+
+ private:
+    static vec flip(vec v) {
+        return std::is_signed<T>::value
+                       ? v
+                       : _mm256_xor_si256(v, _mm256_set1_epi64x(INT64_MIN));
+    }
+};
+
+/**
+ * AVX2 kernel for single precision floats.
+ */
+template <>
+struct SimdKernel<float, void> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    using vec = __m256;
+    using index = __m256i;
+
+    static index init() { return _mm256_set1_epi32(1); }
+
+    static vec load(const float* p) { return _mm256_loadu_ps(p); }
+
+    static vec gather(const float* base, index b) {
+        return _mm256_i32gather_ps(base, b, sizeof(float));
+    }
+
+    static index offset(index b, int off) {
+        return _mm256_sub_epi32(b, _mm256_set1_epi32(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        return _mm256_sub_epi32(_mm256_add_epi32(b, b),
+                                _mm256_castps_si256(_mm256_cmp_ps(s, x, _CMP_LT_OQ)));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        return _mm256_sub_epi32(_mm256_add_epi32(b, b),
+                                _mm256_castps_si256(_mm256_cmp_ps(x, s, _CMP_NLT_UQ)));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), b);
+    }
+};
+
+/**
+ * AVX2 kernel for double precision floats.
+ */
+template <>
+struct SimdKernel<double, void> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 4;
+    using vec = __m256d;
+    using index = __m256i;
+
+    static index init() { return _mm256_set1_epi64x(1); }
+
+    static vec load(const double* p) { return _mm256_loadu_pd(p); }
+
+    static vec gather(const double* base, index b) {
+        return _mm256_i64gather_pd(base, b, sizeof(double));
+    }
+
+    static index offset(index b, int off) {
+        return _mm256_sub_epi64(b, _mm256_set1_epi64x(off));
+    }
+
+    static index descend(index b, vec s, vec x) {
+        return _mm256_sub_epi64(_mm256_add_epi64(b, b),
+                                _mm256_castpd_si256(_mm256_cmp_pd(s, x, _CMP_LT_OQ)));
+    }
+
+    static index descendEqual(index b, vec s, vec x) {
+        return _mm256_sub_epi64(_mm256_add_epi64(b, b),
+                                _mm256_castpd_si256(_mm256_cmp_pd(x, s, _CMP_NLT_UQ)));
+    }
+
+    static void store(std::int32_t* out, index b) {
+        const __m256i lo = _mm256_permutevar8x32_epi32(
+                b, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(lo));
+    }
+};
+
+#endif  // __AVX512F__ / __AVX2__
+
+/**
+ * Comparators for which the vectorized classifier computes the same result.
+ */
+template <class T, class Comp>
+struct IsSimdComparator
+    : std::integral_constant<bool, std::is_same<Comp, std::less<>>::value
+                                           || std::is_same<Comp, std::less<T>>::value> {};
+
+/**
+ * Iterators which point into contiguous memory.
+ */
+template <class It, class T = typename std::iterator_traits<It>::value_type>
+struct IsContiguousIterator
+    : std::integral_constant<bool,
+                             std::is_pointer<It>::value
+                                     || std::is_same<It, typename std::vector<
+                                                                 T>::iterator>::value> {};
+
+/**
+ * Whether the vectorized classifier can be used for keys of type Key.
+ */
+template <class Key, class KeyLess>
+struct UseSimdClassifier
+    : std::integral_constant<bool, SimdKernel<Key>::kEnabled
+                                           && IsSimdComparator<Key, KeyLess>::value> {};
+
+/**
+ * Classifies kUnroll * kLanes consecutive elements.
+ * Writes bucket indices relative to the first bucket to out.
+ */
+template <class Kernel, int kLogBuckets, bool kEqualBuckets, int kUnroll, class T>
+inline void simdClassify(const T* tree, const T* sorted, const T* in,
+                         std::int32_t* out) {
+    constexpr const int kLanes = Kernel::kLanes;
+    constexpr const int kNumBuckets = 1 << (kLogBuckets + kEqualBuckets);
+    typename Kernel::vec x[kUnroll];
+    typename Kernel::index b[kUnroll];
+
+    for (int i = 0; i < kUnroll; ++i) {
+        x[i] = Kernel::load(in + i * kLanes);
+        b[i] = Kernel::init();
+    }
+
+    for (int l = 0; l < kLogBuckets; ++l)
+        for (int i = 0; i < kUnroll; ++i)
+            b[i] = Kernel::descend(b[i], Kernel::gather(tree, b[i]), x[i]);
+
+    if (kEqualBuckets)
+        for (int i = 0; i < kUnroll; ++i)
+            b[i] = Kernel::descendEqual(
+                    b[i], Kernel::gather(sorted, Kernel::offset(b[i], kNumBuckets / 2)),
+                    x[i]);
+
+    for (int i = 0; i < kUnroll; ++i)
+        Kernel::store(out + i * kLanes, Kernel::offset(b[i], kNumBuckets));
+}
+
+}  // namespace detail
+}  // namespace ips4o
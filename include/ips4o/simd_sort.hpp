@@ -0,0 +1,637 @@
+/******************************************************************************
+ * include/ips4o/simd_sort.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace ips4o {
+namespace detail {
+
+/**
+ * Mask of the lanes whose index has any bit of b set.
+ */
+constexpr unsigned simdLaneMask(int lanes, int b) {
+    unsigned mask = 0;
+    for (int l = 0; l < lanes; ++l)
+        if (l & b) mask |= 1u << l;
+    return mask;
+}
+
+/**
+ * Vector operations on signed integer keys of the given width.
+ *
+ * swizzle<X> moves lane l ^ X to lane l, and blend<B> takes the lanes of hi whose
+ * index has bit B set. Registers are padded with the maximum key. Smaller inputs
+ * than kMinSize are left to the scalar sorting networks.
+ */
+template <std::size_t Width>
+struct SimdSortKernel {
+    static constexpr const bool kEnabled = false;
+};
+
+#if defined(__AVX512F__)
+
+// GCC 12 reports the self-initialized _mm512_undefined_epi32() in its own min, max
+// and permute intrinsics as uninitialized (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+/**
+ * AVX-512 kernel for 32-bit keys.
+ */
+template <>
+struct SimdSortKernel<4> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 16;
+    static constexpr const int kMaxRegisters = 16;
+    static constexpr const int kMinSize = 9;
+    using key = std::int32_t;
+    using reg = __m512i;
+
+    static reg load(const key* p) { return _mm512_loadu_si512(p); }
+
+    // Loads the first valid lanes, the others are zero
+    static reg loadPartial(const key* p, int valid) {
+        return _mm512_maskz_loadu_epi32(static_cast<__mmask16>((1u << valid) - 1), p);
+    }
+
+    static void store(key* p, reg v) { _mm512_storeu_si512(p, v); }
+
+    static reg pad(reg v, int valid) {
+        return _mm512_mask_mov_epi32(_mm512_set1_epi32(INT32_MAX),
+                                     static_cast<__mmask16>((1u << valid) - 1), v);
+    }
+
+    static reg flip(reg v, key mask) {
+        return _mm512_xor_si512(v, _mm512_set1_epi32(mask));
+    }
+
+    // Reverses the order of negative keys
+    static reg flipNegative(reg v) {
+        return _mm512_xor_si512(v, _mm512_and_si512(_mm512_srai_epi32(v, 31),
+                                                     _mm512_set1_epi32(INT32_MAX)));
+    }
+
+    static void minmax(reg a, reg b, reg& lo, reg& hi) {
+        lo = _mm512_min_epi32(a, b);
+        hi = _mm512_max_epi32(a, b);
+    }
+
+    template <int X>
+    static reg swizzle(reg v) {
+        const reg idx = _mm512_xor_si512(
+                _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0),
+                _mm512_set1_epi32(X));
+        return _mm512_permutexvar_epi32(idx, v);
+    }
+
+    template <int B>
+    static reg blend(reg lo, reg hi) {
+        return _mm512_mask_blend_epi32(simdLaneMask(kLanes, B), lo, hi);
+    }
+};
+
+/**
+ * AVX-512 kernel for 64-bit keys.
+ */
+template <>
+struct SimdSortKernel<8> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    static constexpr const int kMaxRegisters = 16;
+    static constexpr const int kMinSize = 9;
+    using key = std::int64_t;
+    using reg = __m512i;
+
+    static reg load(const key* p) { return _mm512_loadu_si512(p); }
+
+    static reg loadPartial(const key* p, int valid) {
+        return _mm512_maskz_loadu_epi64(static_cast<__mmask8>((1u << valid) - 1), p);
+    }
+
+    static void store(key* p, reg v) { _mm512_storeu_si512(p, v); }
+
+    static reg pad(reg v, int valid) {
+        return _mm512_mask_mov_epi64(_mm512_set1_epi64(INT64_MAX),
+                                     static_cast<__mmask8>((1u << valid) - 1), v);
+    }
+
+    static reg flip(reg v, key mask) {
+        return _mm512_xor_si512(v, _mm512_set1_epi64(mask));
+    }
+
+    static reg flipNegative(reg v) {
+        return _mm512_xor_si512(v, _mm512_and_si512(_mm512_srai_epi64(v, 63),
+                                                     _mm512_set1_epi64(INT64_MAX)));
+    }
+
+    static void minmax(reg a, reg b, reg& lo, reg& hi) {
+        lo = _mm512_min_epi64(a, b);
+        hi = _mm512_max_epi64(a, b);
+    }
+
+    template <int X>
+    static reg swizzle(reg v) {
+        const reg idx = _mm512_xor_si512(_mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0),
+                                         _mm512_set1_epi64(X));
+        return _mm512_permutexvar_epi64(idx, v);
+    }
+
+    template <int B>
+    static reg blend(reg lo, reg hi) {
+        return _mm512_mask_blend_epi64(simdLaneMask(kLanes, B), lo, hi);
+    }
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(__AVX2__)
+
+/**
+ * AVX2 kernel for 32-bit keys.
+ */
+template <>
+struct SimdSortKernel<4> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 8;
+    static constexpr const int kMaxRegisters = 8;
+    static constexpr const int kMinSize = 9;
+    using key = std::int32_t;
+    using reg = __m256i;
+
+    static reg load(const key* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    // Loads the first valid lanes, the others are zero
+    static reg loadPartial(const key* p, int valid) {
+        const reg keep = _mm256_cmpgt_epi32(_mm256_set1_epi32(valid),
+                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return _mm256_maskload_epi32(reinterpret_cast<const int*>(p), keep);
+    }
+
+    static void store(key* p, reg v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+    }
+
+    static reg pad(reg v, int valid) {
+        const reg keep = _mm256_cmpgt_epi32(_mm256_set1_epi32(valid),
+                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return _mm256_blendv_epi8(_mm256_set1_epi32(INT32_MAX), v, keep);
+    }
+
+    static reg flip(reg v, key mask) {
+        return _mm256_xor_si256(v, _mm256_set1_epi32(mask));
+    }
+
+    static reg flipNegative(reg v) {
+        return _mm256_xor_si256(v, _mm256_and_si256(_mm256_srai_epi32(v, 31),
+                                                     _mm256_set1_epi32(INT32_MAX)));
+    }
+
+    static void minmax(reg a, reg b, reg& lo, reg& hi) {
+        lo = _mm256_min_epi32(a, b);
+        hi = _mm256_max_epi32(a, b);
+    }
+
+    template <int X>
+    static reg swizzle(reg v) {
+        const reg idx = _mm256_xor_si256(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                         _mm256_set1_epi32(X));
+        return _mm256_permutevar8x32_epi32(v, idx);
+    }
+
+    template <int B>
+    static reg blend(reg lo, reg hi) {
+        return _mm256_blend_epi32(lo, hi, simdLaneMask(kLanes, B));
+    }
+};
+
+/**
+ * AVX2 kernel for 64-bit keys.
+ * There is no 64-bit minimum, so a single comparison selects both results.
+ */
+template <>
+struct SimdSortKernel<8> {
+    static constexpr const bool kEnabled = true;
+    static constexpr const int kLanes = 4;
+    static constexpr const int kMaxRegisters = 8;
+    static constexpr const int kMinSize = 17;
+    using key = std::int64_t;
+    using reg = __m256i;
+
+    static reg load(const key* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    static reg loadPartial(const key* p, int valid) {
+        const reg keep = _mm256_cmpgt_epi64(_mm256_set1_epi64x(valid),
+                                            _mm256_setr_epi64x(0, 1, 2, 3));
+        return _mm256_maskload_epi64(reinterpret_cast<const long long*>(p), keep);
+    }
+
+    static void store(key* p, reg v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+    }
+
+    static reg pad(reg v, int valid) {
+        const reg keep = _mm256_cmpgt_epi64(_mm256_set1_epi64x(valid),
+                                            _mm256_setr_epi64x(0, 1, 2, 3));
+        return _mm256_blendv_epi8(_mm256_set1_epi64x(INT64_MAX), v, keep);
+    }
+
+    static reg flip(reg v, key mask) {
+        return _mm256_xor_si256(v, _mm256_set1_epi64x(mask));
+    }
+
+    static reg flipNegative(reg v) {
+        const reg negative = _mm256_cmpgt_epi64(_mm256_setzero_si256(), v);
+        return _mm256_xor_si256(v, _mm256_and_si256(negative,
+                                                    _mm256_set1_epi64x(INT64_MAX)));
+    }
+
+    static void minmax(reg a, reg b, reg& lo, reg& hi) {
+        const reg gt = _mm256_cmpgt_epi64(a, b);
+        lo = _mm256_blendv_epi8(a, b, gt);
+        hi = _mm256_blendv_epi8(b, a, gt);
+    }
+
+    template <int X>
+    static reg swizzle(reg v) {
+        return _mm256_permute4x64_epi64(
+                v, (0 ^ X) | ((1 ^ X) << 2) | ((2 ^ X) << 4) | ((3 ^ X) << 6));
+    }
+
+    template <int B>
+    static reg blend(reg lo, reg hi) {
+        // Each 64-bit lane covers two 32-bit lanes
+        return _mm256_blend_epi32(lo, hi, simdLaneMask(8, 2 * B));
+    }
+};
+
+#endif  // __AVX512F__ / __AVX2__
+
+/**
+ * Maps values to signed integer keys whose order matches the comparator.
+ * Floats order like their sign-magnitude integers after reversing the negative
+ * range; the descending order is the bitwise complement. The mapping is a
+ * bijection, so sorting the keys permutes the values even if there are NaNs.
+ */
+template <class T, bool kDescending, class Kernel>
+struct SimdSortKeyMap {
+    using key = typename Kernel::key;
+    using reg = typename Kernel::reg;
+
+    static constexpr const key kMask =
+            (std::is_unsigned<T>::value ? std::numeric_limits<key>::min() : key(0))
+            ^ (kDescending ? key(-1) : key(0));
+
+    static reg toKey(reg v) {
+        if (std::is_floating_point<T>::value) v = Kernel::flipNegative(v);
+        return kMask ? Kernel::flip(v, kMask) : v;
+    }
+
+    static reg fromKey(reg v) {
+        if (kMask) v = Kernel::flip(v, kMask);
+        return std::is_floating_point<T>::value ? Kernel::flipNegative(v) : v;
+    }
+};
+
+/**
+ * Value types and comparators supported by the vectorized base case.
+ */
+template <class Comp, class T>
+struct UseSimdSort {
+    static constexpr const bool kAscending =
+            std::is_same<Comp, std::less<>>::value
+            || std::is_same<Comp, std::less<T>>::value;
+    static constexpr const bool kDescending =
+            std::is_same<Comp, std::greater<>>::value
+            || std::is_same<Comp, std::greater<T>>::value;
+    static constexpr const bool value =
+            std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+            && (sizeof(T) == 4 || sizeof(T) == 8) && SimdSortKernel<sizeof(T)>::kEnabled
+            && (kAscending || kDescending);
+};
+
+/**
+ * Compare-exchange of lanes l and l ^ X; lanes with bit B receive the maximum.
+ */
+template <class Kernel, int X, int B>
+inline typename Kernel::reg simdExchange(typename Kernel::reg v) {
+    typename Kernel::reg lo, hi;
+    Kernel::minmax(v, Kernel::template swizzle<X>(v), lo, hi);
+    return Kernel::template blend<B>(lo, hi);
+}
+
+/**
+ * Sorts a bitonic register, i.e., the last log(D) + 1 layers of a bitonic merge.
+ */
+template <class Kernel, int D>
+struct SimdRegisterMerger {
+    static typename Kernel::reg apply(typename Kernel::reg v) {
+        return SimdRegisterMerger<Kernel, D / 2>::apply(simdExchange<Kernel, D, D>(v));
+    }
+};
+
+template <class Kernel>
+struct SimdRegisterMerger<Kernel, 0> {
+    static typename Kernel::reg apply(typename Kernel::reg v) { return v; }
+};
+
+/**
+ * Sorts groups of K lanes within a register.
+ */
+template <class Kernel, int K>
+struct SimdRegisterSorter {
+    static typename Kernel::reg apply(typename Kernel::reg v) {
+        v = SimdRegisterSorter<Kernel, K / 2>::apply(v);
+        v = simdExchange<Kernel, K - 1, K / 2>(v);
+        return SimdRegisterMerger<Kernel, K / 4>::apply(v);
+    }
+};
+
+template <class Kernel>
+struct SimdRegisterSorter<Kernel, 1> {
+    static typename Kernel::reg apply(typename Kernel::reg v) { return v; }
+};
+
+/**
+ * Bitonic sort of N registers, viewed as one sequence of N * kLanes keys.
+ */
+template <class Kernel, int N>
+struct SimdBitonic {
+    using reg = typename Kernel::reg;
+    static constexpr const int kReverse = Kernel::kLanes - 1;
+
+    static void sort(reg* v) {
+        SimdBitonic<Kernel, N / 2>::sort(v);
+        SimdBitonic<Kernel, N / 2>::sort(v + N / 2);
+        // Compares the first half with the reversed second half
+        for (int i = 0; i < N / 2; ++i) {
+            reg lo, hi, unused;
+            Kernel::minmax(v[i], Kernel::template swizzle<kReverse>(v[N - 1 - i]), lo,
+                           unused);
+            Kernel::minmax(Kernel::template swizzle<kReverse>(v[i]), v[N - 1 - i],
+                           unused, hi);
+            v[i] = lo;
+            v[N - 1 - i] = hi;
+        }
+        SimdBitonic<Kernel, N / 2>::merge(v);
+        SimdBitonic<Kernel, N / 2>::merge(v + N / 2);
+    }
+
+    static void merge(reg* v) {
+        for (int i = 0; i < N / 2; ++i)
+            Kernel::minmax(v[i], v[i + N / 2], v[i], v[i + N / 2]);
+        SimdBitonic<Kernel, N / 2>::merge(v);
+        SimdBitonic<Kernel, N / 2>::merge(v + N / 2);
+    }
+};
+
+template <class Kernel, int N>
+constexpr const int SimdBitonic<Kernel, N>::kReverse;
+
+template <class Kernel>
+struct SimdBitonic<Kernel, 1> {
+    using reg = typename Kernel::reg;
+
+    static void sort(reg* v) {
+        *v = SimdRegisterSorter<Kernel, Kernel::kLanes>::apply(*v);
+    }
+
+    static void merge(reg* v) {
+        *v = SimdRegisterMerger<Kernel, Kernel::kLanes / 2>::apply(*v);
+    }
+};
+
+/**
+ * Sorts the keys in [p, p + n) in registers, padding up to N registers.
+ * Values are mapped to keys on load and mapped back on store if Final is set.
+ * Lanes past n are not read from memory.
+ */
+template <class Map, class Kernel, int N, bool Final>
+inline void simdSortBlock(typename Kernel::key* p, const int n) {
+    constexpr const int kLanes = Kernel::kLanes;
+    typename Kernel::reg v[N];
+    for (int i = 0; i < N; ++i) {
+        const int valid = n - i * kLanes;
+        if (valid >= kLanes) {
+            v[i] = Map::toKey(Kernel::load(p + i * kLanes));
+        } else {
+            const int lanes = valid > 0 ? valid : 0;
+            v[i] = Kernel::pad(Map::toKey(Kernel::loadPartial(p + i * kLanes, lanes)),
+                               lanes);
+        }
+    }
+    SimdBitonic<Kernel, N>::sort(v);
+    for (int i = 0; i < N; ++i)
+        Kernel::store(p + i * kLanes, Final ? Map::fromKey(v[i]) : v[i]);
+}
+
+template <class Map, class Kernel, bool Final>
+inline void simdSortBlock(typename Kernel::key* p, const int n) {
+    constexpr const int kLanes = Kernel::kLanes;
+    constexpr const int kMax = Kernel::kMaxRegisters;
+    if (n <= kLanes)
+        simdSortBlock<Map, Kernel, 1, Final>(p, n);
+    else if (n <= 2 * kLanes)
+        simdSortBlock<Map, Kernel, 2, Final>(p, n);
+    else if (n <= 4 * kLanes)
+        simdSortBlock<Map, Kernel, 4, Final>(p, n);
+    else if (n <= 8 * kLanes)
+        simdSortBlock<Map, Kernel, 8, Final>(p, n);
+    else
+        simdSortBlock<Map, Kernel, kMax, Final>(p, n);
+}
+
+/**
+ * Merges two sorted runs of keys whose lengths are multiples of kLanes.
+ * Each step merges the register with the smaller head into the carried register.
+ */
+template <class Kernel>
+inline void simdMerge(const typename Kernel::key* a, const typename Kernel::key* a_end,
+                      const typename Kernel::key* b, const typename Kernel::key* b_end,
+                      typename Kernel::key* out) {
+    using reg = typename Kernel::reg;
+    constexpr const int kLanes = Kernel::kLanes;
+
+    const auto step = [](reg& lo, reg& hi) {
+        Kernel::minmax(lo, Kernel::template swizzle<kLanes - 1>(hi), lo, hi);
+        lo = SimdRegisterMerger<Kernel, kLanes / 2>::apply(lo);
+        hi = SimdRegisterMerger<Kernel, kLanes / 2>::apply(hi);
+    };
+
+    reg lo = Kernel::load(a);
+    reg hi = Kernel::load(b);
+    a += kLanes;
+    b += kLanes;
+    step(lo, hi);
+    Kernel::store(out, lo);
+    out += kLanes;
+
+    while (a != a_end && b != b_end) {
+        const bool take_a = *a < *b;
+        lo = Kernel::load(take_a ? a : b);
+        a += take_a ? kLanes : 0;
+        b += take_a ? 0 : kLanes;
+        step(lo, hi);
+        Kernel::store(out, lo);
+        out += kLanes;
+    }
+    for (; a != a_end; a += kLanes, out += kLanes) {
+        lo = Kernel::load(a);
+        step(lo, hi);
+        Kernel::store(out, lo);
+    }
+    for (; b != b_end; b += kLanes, out += kLanes) {
+        lo = Kernel::load(b);
+        step(lo, hi);
+        Kernel::store(out, lo);
+    }
+    Kernel::store(out, hi);
+}
+
+/**
+ * Copies values into a key buffer and back.
+ */
+template <class It, class Key>
+inline void simdLoadValues(const It begin, const std::ptrdiff_t n, Key* out) {
+    using T = typename std::iterator_traits<It>::value_type;
+    for (std::ptrdiff_t i = 0; i < n; ++i) {
+        const T value = begin[i];
+        std::memcpy(out + i, &value, sizeof(T));
+    }
+}
+
+template <class It, class Key>
+inline void simdStoreValues(const Key* in, const std::ptrdiff_t n, const It begin) {
+    using T = typename std::iterator_traits<It>::value_type;
+    for (std::ptrdiff_t i = 0; i < n; ++i) {
+        T value;
+        std::memcpy(&value, in + i, sizeof(T));
+        begin[i] = value;
+    }
+}
+
+/**
+ * Sorts up to kMaxSize values: blocks are sorted in registers and merged bottom-up.
+ */
+template <class Map, class Kernel, std::ptrdiff_t kMaxSize, class It>
+void simdMergeSort(const It begin, const std::ptrdiff_t n) {
+    using key = typename Kernel::key;
+    constexpr const int kLanes = Kernel::kLanes;
+    constexpr const int kBlock = kLanes * Kernel::kMaxRegisters;
+
+    alignas(64) key buffer[2][kMaxSize + kBlock];
+    key* sorted = buffer[0];
+    key* out = buffer[1];
+    simdLoadValues(begin, n, sorted);
+
+    const auto padded = (n + kLanes - 1) / kLanes * kLanes;
+    for (std::ptrdiff_t i = 0; i < n; i += kBlock) {
+        simdSortBlock<Map, Kernel, false>(
+                sorted + i, static_cast<int>(std::min<std::ptrdiff_t>(kBlock, n - i)));
+    }
+
+    for (std::ptrdiff_t width = kBlock; width < padded; width *= 2) {
+        for (std::ptrdiff_t i = 0; i < padded; i += 2 * width) {
+            const auto mid = std::min(i + width, padded);
+            const auto stop = std::min(i + 2 * width, padded);
+            if (mid == stop)
+                std::copy(sorted + i, sorted + stop, out + i);
+            else
+                simdMerge<Kernel>(sorted + i, sorted + mid, sorted + mid, sorted + stop,
+                                  out + i);
+        }
+        std::swap(sorted, out);
+    }
+
+    for (std::ptrdiff_t i = 0; i < padded; i += kLanes)
+        Kernel::store(sorted + i, Map::fromKey(Kernel::load(sorted + i)));
+    simdStoreValues(sorted, n, begin);
+}
+
+/**
+ * Vectorized base case for 32- and 64-bit arithmetic values.
+ *
+ * Values are mapped to signed integer keys, blocks of up to kMaxRegisters registers
+ * are sorted with in-register bitonic networks, and larger inputs merge the blocks
+ * with a vectorized two-way merge. Returns false if the range is too small to
+ * benefit or too large for the stack buffer.
+ */
+template <class It, class Comp>
+bool simdSort(const It begin, const It end, const Comp&) {
+    using T = typename std::iterator_traits<It>::value_type;
+    using Kernel = SimdSortKernel<sizeof(T)>;
+    using Map = SimdSortKeyMap<T, UseSimdSort<Comp, T>::kDescending, Kernel>;
+    constexpr const std::ptrdiff_t kMaxSize = 1024;
+    constexpr const int kBlock = Kernel::kLanes * Kernel::kMaxRegisters;
+
+    const auto n = end - begin;
+    if (n < Kernel::kMinSize || n > kMaxSize) return false;
+
+    if (n > kBlock) {
+        simdMergeSort<Map, Kernel, kMaxSize>(begin, n);
+    } else {
+        alignas(64) typename Kernel::key buffer[kBlock];
+        simdLoadValues(begin, n, buffer);
+        simdSortBlock<Map, Kernel, true>(buffer, static_cast<int>(n));
+        simdStoreValues(buffer, n, begin);
+    }
+    return true;
+}
+
+}  // namespace detail
+}  // namespace ips4o
@@ -0,0 +1,174 @@
+/******************************************************************************
+ * include/ips4o/splitter_cache.hpp
+ *
+ * In-place Parallel Super Scalar Samplesort (IPS⁴o)
+ *
+ ******************************************************************************
+ * BSD 2-Clause License
+ *
+ * Copyright © 2017, Michael Axtmann <michael.axtmann@gmail.com>
+ * Copyright © 2017, Daniel Ferizovic <daniel.ferizovic@student.kit.edu>
+ * Copyright © 2017, Sascha Witt <sascha.witt@kit.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+
+#include "ips4o_fwd.hpp"
+#include "memory_resource.hpp"
+#include "utils.hpp"
+
+namespace ips4o {
+namespace detail {
+
+/**
+ * Top-level splitters kept between the sorts of a reusable sorter.
+ * Splitters are stored sorted and padded with copies of the largest one to one less
+ * than a power of two, as in the classifier.
+ */
+template <class Cfg>
+class SplitterCache {
+    using key_type = typename Cfg::key_type;
+    using key_less = typename Cfg::key_less;
+    using diff_t = typename Cfg::difference_type;
+
+ public:
+    explicit SplitterCache(memory_resource* resource = get_default_resource())
+        : splitters_(resource) {}
+
+    /**
+     * Sets whether sampled splitters are kept for the next sort, and the maximum
+     * ratio between the largest bucket and the average bucket.
+     */
+    void setReuse(const bool keep_sampled, const double max_imbalance) {
+        keep_sampled_ = keep_sampled;
+        max_imbalance_ = max_imbalance;
+    }
+
+    bool keepsSampled() const { return keep_sampled_; }
+
+    bool empty() const { return log_buckets_ == 0; }
+
+    int logBuckets() const { return log_buckets_; }
+
+    bool equalBuckets() const { return equal_buckets_; }
+
+    const key_type* splitters() const { return splitters_.data(); }
+
+    /**
+     * Whether the splitters can replace sampling for an input of size n.
+     * Small inputs are sorted by the base case right after partitioning, so they
+     * always sample.
+     */
+    bool usableFor(const diff_t n) const {
+        return !empty() && n > Cfg::kSingleLevelThreshold
+               && log_buckets_ <= Cfg::logBuckets(n);
+    }
+
+    /**
+     * Stores the padded splitters of a classifier.
+     */
+    void assign(const key_type* sorted_splitters, const int log_buckets,
+                const bool equal_buckets, const key_less& less) {
+        const int num_splitters = (1 << log_buckets) - 1;
+        splitters_.assign(sorted_splitters, sorted_splitters + num_splitters);
+        log_buckets_ = log_buckets;
+        equal_buckets_ = equal_buckets;
+        countBuckets(less);
+    }
+
+    /**
+     * Stores user-supplied splitters. Duplicates are removed, and at most
+     * 2^kLogBuckets - 1 evenly spaced keys are kept.
+     */
+    template <class KeyIt>
+    void assign(KeyIt first, KeyIt last, const key_less& less) {
+        Vector<key_type> keys(first, last, splitters_.get_allocator());
+        std::sort(keys.begin(), keys.end(), less);
+        keys.erase(std::unique(keys.begin(), keys.end(),
+                               [&less](const key_type& a, const key_type& b) {
+                                   return !less(a, b);
+                               }),
+                   keys.end());
+        if (keys.empty()) {
+            clear();
+            return;
+        }
+
+        const diff_t max_splitters = (diff_t{1} << Cfg::kLogBuckets) - 1;
+        const diff_t num_keys = keys.size();
+        const diff_t num_splitters = std::min(num_keys, max_splitters);
+        log_buckets_ = log2(num_splitters) + 1;
+        equal_buckets_ = false;
+        splitters_.clear();
+        splitters_.reserve((diff_t{1} << log_buckets_) - 1);
+        for (diff_t i = 0; i < num_splitters; ++i)
+            splitters_.push_back(std::move(keys[(i * num_keys) / num_splitters]));
+        while (static_cast<diff_t>(splitters_.size()) < (diff_t{1} << log_buckets_) - 1)
+            splitters_.push_back(splitters_.back());
+        num_buckets_ = num_splitters + 1;
+    }
+
+    void clear() {
+        splitters_.clear();
+        log_buckets_ = 0;
+    }
+
+    /**
+     * Drops the splitters if the largest bucket of a partitioning step exceeds the
+     * allowed imbalance. Equality buckets are not counted.
+     */
+    void validate(const diff_t* bucket_start, const int num_buckets,
+                  const bool equal_buckets) {
+        if (empty()) return;
+        const int step = 1 + equal_buckets;
+        diff_t max_size = 0;
+        for (int i = 0; i < num_buckets; i += step)
+            max_size = std::max(max_size, bucket_start[i + 1] - bucket_start[i]);
+        const diff_t n = bucket_start[num_buckets];
+        if (max_size * static_cast<double>(num_buckets_) > max_imbalance_ * n) clear();
+    }
+
+ private:
+    /**
+     * Counts the buckets which are not empty due to padding.
+     */
+    void countBuckets(const key_less& less) {
+        num_buckets_ = 2;
+        for (std::size_t i = 1; i < splitters_.size(); ++i)
+            num_buckets_ += less(splitters_[i - 1], splitters_[i]);
+    }
+
+    Vector<key_type> splitters_;
+    double max_imbalance_ = 4.0;
+    bool keep_sampled_ = false;
+    int log_buckets_ = 0;
+    int num_buckets_ = 0;
+    bool equal_buckets_ = false;
+};
+
+}  // namespace detail
+}  // namespace ips4o
@@ -35,19 +35,41 @@
 
 #pragma once
 #if defined(_REENTRANT)
+#include <atomic>
+#include <climits>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace ips4o {
 namespace detail {
 
 /**
- * Thread barrier, also supports single() execution.
+ * Tells the CPU that this thread busy-waits.
+ */
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * Sense-reversing thread barrier, also supports single() execution.
+ * Waiting threads spin on the generation for a while and then sleep on it, on
+ * Linux with a futex. The thread releasing the barrier only wakes threads if
+ * some are asleep.
  */
 class Barrier {
  public:
-    explicit Barrier(int num_threads)
-        : init_count_(num_threads), hit_count_(num_threads), flag_(false) {}
+    explicit Barrier(int num_threads) : num_threads_(num_threads), count_(num_threads) {}
 
     inline void barrier();
 
@@ -59,17 +81,28 @@ class Barrier {
      * No thread must currently be waiting at this barrier.
      */
     void setNumThreads(int num_threads) {
-        hit_count_ = init_count_ = num_threads;
+        num_threads_ = num_threads;
+        count_.store(num_threads, std::memory_order_relaxed);
     }
 
  private:
+    static constexpr int kSpinIterations = 1 << 12;
+
+    inline void wait(std::uint32_t generation);
+    inline void wakeAll();
+
+    int num_threads_;
+    // Arrivals and generation on separate cache lines, as waiting threads read the
+    // generation while the others arrive
+    std::atomic<int> count_;
+    std::atomic<int> single_{0};
+    char padding_[64];
+    std::atomic<std::uint32_t> generation_{0};
+    std::atomic<int> sleeping_{0};
+#if !defined(__linux__)
     std::mutex mutex_;
     std::condition_variable cv_;
-    int init_count_;
-    int hit_count_;
-    bool flag_;
-
-    inline void notify_all(std::unique_lock<std::mutex>& lk);
+#endif
 };
 
 /**
@@ -90,11 +123,16 @@ class Sync : public Barrier {
  * Barrier: Execution resumes only after all threads reached this point.
  */
 void Barrier::barrier() {
-    std::unique_lock<std::mutex> lk(mutex_);
-    if (--hit_count_ == 0) {
-        notify_all(lk);
-    } else
-        cv_.wait(lk, [this, f = flag_] { return f != flag_; });
+    // The generation cannot change before this thread arrives
+    const std::uint32_t generation = generation_.load(std::memory_order_relaxed);
+    if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        count_.store(num_threads_, std::memory_order_relaxed);
+        single_.store(0, std::memory_order_relaxed);
+        generation_.store(generation + 1, std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_seq_cst) != 0) wakeAll();
+    } else {
+        wait(generation);
+    }
 }
 
 /**
@@ -102,27 +140,49 @@ void Barrier::barrier() {
  */
 template <class F>
 void Barrier::single(F&& func) {
-    std::unique_lock<std::mutex> lk(mutex_);
-    if (hit_count_-- == init_count_) {
-        lk.unlock();
-        func();
-        lk.lock();
-        --hit_count_;
+    if (single_.fetch_add(1, std::memory_order_relaxed) == 0) func();
+    barrier();
+}
+
+/**
+ * Waits until the generation differs from the given one.
+ */
+void Barrier::wait(const std::uint32_t generation) {
+    for (int i = 0; i != kSpinIterations; ++i) {
+        if (generation_.load(std::memory_order_acquire) != generation) return;
+        cpuRelax();
+    }
+
+    sleeping_.fetch_add(1, std::memory_order_seq_cst);
+#if defined(__linux__)
+    while (generation_.load(std::memory_order_seq_cst) == generation) {
+        // Returns at once if the generation has changed in the meantime
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&generation_),
+                FUTEX_WAIT_PRIVATE, generation, nullptr, nullptr, 0);
+    }
+#else
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        cv_.wait(lk, [this, generation] {
+            return generation_.load(std::memory_order_seq_cst) != generation;
+        });
     }
-    if (hit_count_ < 0)
-        notify_all(lk);
-    else
-        cv_.wait(lk, [this, f = flag_] { return f != flag_; });
+#endif
+    sleeping_.fetch_sub(1, std::memory_order_relaxed);
 }
 
 /**
- * Wakes up waiting threads.
+ * Wakes up sleeping threads.
  */
-void Barrier::notify_all(std::unique_lock<std::mutex>& lk) {
-    hit_count_ = init_count_;
-    flag_ = !flag_;
-    lk.unlock();
+void Barrier::wakeAll() {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&generation_), FUTEX_WAKE_PRIVATE,
+            INT_MAX, nullptr, nullptr, 0);
+#else
+    // Sleeping threads either have not checked the generation yet or wait
+    { std::lock_guard<std::mutex> lk(mutex_); }
     cv_.notify_all();
+#endif
 }
 
 /**
@@ -43,14 +43,18 @@
 
 #ifdef _REENTRANT
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "synchronization.hpp"
+#include "utils.hpp"
 #endif  // _REENTRANT
 
 namespace ips4o {
@@ -151,7 +155,7 @@ class StdThreadPool {
         Sync sync_;
         detail::Barrier pool_barrier_;
         std::vector<std::thread> threads_;
-        std::function<void(int, int)> func_;
+        detail::FunctionRef<void(int, int)> func_;
         int num_threads_;
         bool done_ = false;
 
@@ -196,7 +200,8 @@ inline StdThreadPool::Impl::~Impl() {
  */
 template <class F>
 inline void StdThreadPool::Impl::run(F&& func, int num_threads) {
-    func_ = func;
+    // All threads are done with func after the second barrier
+    func_ = detail::FunctionRef<void(int, int)>(func);
     num_threads_ = num_threads;
     sync_.setNumThreads(num_threads);
 
@@ -218,6 +223,152 @@ inline void StdThreadPool::Impl::main(const int my_id) {
     }
 }
 
+namespace detail {
+
+/**
+ * Process-wide std::thread pools which are kept between sorts, together with the
+ * sorters built on them. Concurrent sorts lease distinct pools, and each one gets a
+ * fair share of the hardware threads. The threads of idle pools wait on the pool
+ * barrier.
+ */
+class SharedThreadPools {
+    struct Slot {
+        struct State {
+            const void* type;
+            const void* context;
+            std::shared_ptr<void> ptr;
+        };
+
+        explicit Slot(int num_threads) : pool(num_threads) {}
+
+        StdThreadPool pool;
+        // Destroyed before the pool
+        std::vector<State> states;
+    };
+
+ public:
+    /**
+     * Exclusive use of a pool, which is returned when the lease is destroyed.
+     */
+    class Lease {
+     public:
+        Lease() = default;
+
+        Lease(Lease&& other) noexcept
+            : owner_(other.owner_), slot_(std::move(other.slot_)) {}
+
+        Lease& operator=(Lease&&) = delete;
+
+        ~Lease() {
+            if (slot_) owner_->release(std::move(slot_));
+        }
+
+        explicit operator bool() const { return slot_ != nullptr; }
+
+        StdThreadPool& pool() { return slot_->pool; }
+
+        /**
+         * Returns the object of type T kept with the pool for the given context.
+         * The object is constructed from the arguments if there is none yet.
+         */
+        template <class T, class... Args>
+        T& state(const void* context, Args&&... args) {
+            for (const auto& state : slot_->states)
+                if (state.type == typeKey<T>() && state.context == context)
+                    return *static_cast<T*>(state.ptr.get());
+
+            auto ptr = std::make_shared<T>(std::forward<Args>(args)...);
+            slot_->states.push_back({typeKey<T>(), context, ptr});
+            return *ptr;
+        }
+
+     private:
+        friend class SharedThreadPools;
+
+        Lease(SharedThreadPools* owner, std::unique_ptr<Slot> slot)
+            : owner_(owner), slot_(std::move(slot)) {}
+
+        template <class T>
+        static const void* typeKey() {
+            static const char key = 0;
+            return &key;
+        }
+
+        SharedThreadPools* owner_ = nullptr;
+        std::unique_ptr<Slot> slot_;
+    };
+
+    /**
+     * The pools are never destroyed, so that sorts still work while static objects
+     * are destroyed.
+     */
+    static SharedThreadPools& instance() {
+        static auto* const pools = new SharedThreadPools();
+        return *pools;
+    }
+
+    /**
+     * Leases a pool of at most num_threads threads. The lease is empty if the share
+     * of this caller is less than two threads.
+     */
+    Lease acquire(int num_threads) {
+        std::unique_ptr<Slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // A single caller gets all threads it asks for
+            const int max_threads = std::max(1, StdThreadPool::maxNumThreads());
+            if (num_leases_ != 0)
+                num_threads = std::min(num_threads,
+                                       std::max(max_threads - busy_threads_,
+                                                max_threads / (num_leases_ + 1)));
+            if (num_threads < 2) return Lease();
+
+            ++num_leases_;
+            busy_threads_ += num_threads;
+            const auto it = std::find_if(idle_.begin(), idle_.end(),
+                                         [num_threads](const std::unique_ptr<Slot>& idle) {
+                                             return idle->pool.numThreads() == num_threads;
+                                         });
+            if (it != idle_.end()) {
+                slot = std::move(*it);
+                idle_.erase(it);
+            }
+        }
+
+        // Start new threads outside of the lock
+        if (!slot) slot.reset(new Slot(num_threads));
+        return Lease(this, std::move(slot));
+    }
+
+ private:
+    static constexpr int kMaxIdlePools = 4;
+
+    SharedThreadPools() {}
+
+    void release(std::unique_ptr<Slot> slot) {
+        std::unique_ptr<Slot> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --num_leases_;
+            busy_threads_ -= slot->pool.numThreads();
+            // Keep the most recently used pools
+            idle_.push_back(std::move(slot));
+            if (idle_.size() > kMaxIdlePools) {
+                evicted = std::move(idle_.front());
+                idle_.erase(idle_.begin());
+            }
+        }
+        // Join the threads of an evicted pool outside of the lock
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Slot>> idle_;
+    int num_leases_ = 0;
+    int busy_threads_ = 0;
+};
+
+}  // namespace detail
+
 #endif  // _REENTRANT
 
 #if defined(_REENTRANT)
@@ -237,6 +388,16 @@ class ThreadJoiningThreadPool {
 
     void release_threads() { impl_->release_threads(); }
 
+    /**
+     * Prepares an idle pool for the next task with the given number of threads.
+     */
+    void reset(int num_threads) { impl_->reset(num_threads); }
+
+    /**
+     * Returns true if all threads of the last task have left the pool.
+     */
+    bool idle() const { return impl_->active_.load(std::memory_order_acquire) == 0; }
+
     template <class F>
     void operator()(F&& func, int num_threads = std::numeric_limits<int>::max()) {
         num_threads = std::min(num_threads, numThreads());
@@ -254,9 +415,11 @@ class ThreadJoiningThreadPool {
     struct Impl {
         Sync sync_;
         detail::Barrier pool_barrier_;
-        std::function<void(int, int)> func_;
+        detail::FunctionRef<void(int, int)> func_;
         int num_threads_;
         bool done_ = false;
+        // Threads, including the primary one, which have not left the pool yet
+        std::atomic<int> active_;
 
         Impl(int num_threads);
         ~Impl();
@@ -266,6 +429,7 @@ class ThreadJoiningThreadPool {
 
         inline void join(int my_id);
         inline void release_threads();
+        inline void reset(int num_threads);
 
         inline void main(const int my_id);
     };
@@ -277,7 +441,10 @@ class ThreadJoiningThreadPool {
  * Constructor for the std::thread pool.
  */
 inline ThreadJoiningThreadPool::Impl::Impl(int num_threads)
-    : sync_(num_threads), pool_barrier_(num_threads), num_threads_(num_threads) {}
+    : sync_(num_threads)
+    , pool_barrier_(num_threads)
+    , num_threads_(num_threads)
+    , active_(num_threads) {}
 
 /**
  * Destructor for the std::thread pool.
@@ -289,7 +456,7 @@ inline ThreadJoiningThreadPool::Impl::~Impl() { assert(done_ == true); }
  */
 template <class F>
 void ThreadJoiningThreadPool::Impl::run(F&& func, int num_threads) {
-    func_ = func;
+    func_ = detail::FunctionRef<void(int, int)>(func);
     num_threads_ = num_threads;
     sync_.setNumThreads(num_threads);
 
@@ -309,6 +476,8 @@ inline void ThreadJoiningThreadPool::Impl::main(const int my_id) {
             func_(my_id, num_threads_);
         pool_barrier_.barrier();
     }
+    // The pool may be reused from here on
+    active_.fetch_sub(1, std::memory_order_release);
 }
 
 inline void ThreadJoiningThreadPool::Impl::join(int my_id) { main(my_id); }
@@ -316,6 +485,16 @@ inline void ThreadJoiningThreadPool::Impl::join(int my_id) { main(my_id); }
 inline void ThreadJoiningThreadPool::Impl::release_threads() {
     done_ = true;
     pool_barrier_.barrier();
+    active_.fetch_sub(1, std::memory_order_release);
+}
+
+inline void ThreadJoiningThreadPool::Impl::reset(int num_threads) {
+    assert(active_.load(std::memory_order_relaxed) == 0);
+    sync_.setNumThreads(num_threads);
+    pool_barrier_.setNumThreads(num_threads);
+    num_threads_ = num_threads;
+    done_ = false;
+    active_.store(num_threads, std::memory_order_relaxed);
 }
 
 #endif  // defined(_REENTRANT)
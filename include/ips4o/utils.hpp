@@ -40,11 +40,74 @@
 #define IPS4OML_ASSUME_NOT(c) if (c) __builtin_unreachable()
 #define IPS4OML_IS_NOT(c) assert(!(c))
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <utility>
 
 namespace ips4o {
+
+/**
+ * Position of NaNs in floating-point sorts.
+ */
+enum class nan_policy { first, last };
+
+/**
+ * Seeding of the random generators used for sampling.
+ * entropy: Seeds differ between sorters and runs. The entropy source is read once.
+ * fixed: All threads use the configured seed.
+ * per_thread: Each thread derives its seed from the configured seed and its index.
+ */
+enum class seed_policy { entropy, fixed, per_thread };
+
+/**
+ * Counters of the partitioning steps of a reusable sorter.
+ * The imbalance of a step is the size of its largest bucket relative to the average
+ * bucket size, equality buckets excluded.
+ */
+struct partition_statistics {
+    // Partitioning steps which classified their input
+    std::uint64_t partitions = 0;
+    // Steps whose imbalance exceeded the configured imbalance factor
+    std::uint64_t imbalanced_partitions = 0;
+    // Largest imbalance of all steps, in percent
+    std::uint64_t max_imbalance_percent = 0;
+};
+
 namespace detail {
 
+/**
+ * Non-owning reference to a callable. Unlike std::function, binding a callable
+ * never allocates. The callable must outlive all calls.
+ */
+template <class Signature>
+class FunctionRef;
+
+template <class R, class... Args>
+class FunctionRef<R(Args...)> {
+ public:
+    FunctionRef() = default;
+
+    template <class F>
+    FunctionRef(F& func)
+        : object_(const_cast<void*>(static_cast<const void*>(std::addressof(func))))
+        , call_([](void* object, Args... args) -> R {
+            return (*static_cast<F*>(object))(std::forward<Args>(args)...);
+        }) {}
+
+    R operator()(Args... args) const {
+        return call_(object_, std::forward<Args>(args)...);
+    }
+
+ private:
+    void* object_ = nullptr;
+    R (*call_)(void*, Args...) = nullptr;
+};
+
 /**
  * Compute the logarithm to base 2, rounded down.
  */
@@ -52,5 +115,99 @@ inline constexpr unsigned long log2(unsigned long n) {
     return (std::numeric_limits<unsigned long>::digits - 1 - __builtin_clzl(n));
 }
 
+/**
+ * Scrambles the bits of a 64-bit value (SplitMix64 finalizer).
+ */
+inline constexpr std::uint64_t mixBits(std::uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Returns a new seed on every call. Only the first call reads std::random_device,
+ * later seeds are derived from it.
+ */
+inline std::uint64_t entropySeed() {
+    static const std::uint64_t base = [] {
+        std::random_device rdev;
+        return (std::uint64_t{rdev()} << 32) | rdev();
+    }();
+    static std::atomic<std::uint64_t> sequence{0};
+    return mixBits(base + 0x9e3779b97f4a7c15u
+                                  * sequence.fetch_add(1, std::memory_order_relaxed));
+}
+
+/**
+ * Adds a partitioning step to the statistics. Steps may finish concurrently.
+ */
+inline void recordPartition(partition_statistics* stats,
+                            const std::uint64_t imbalance_percent,
+                            const bool imbalanced) {
+    __atomic_fetch_add(&stats->partitions, 1, __ATOMIC_RELAXED);
+    if (imbalanced)
+        __atomic_fetch_add(&stats->imbalanced_partitions, 1, __ATOMIC_RELAXED);
+
+    auto max = __atomic_load_n(&stats->max_imbalance_percent, __ATOMIC_RELAXED);
+    while (max < imbalance_percent
+           && !__atomic_compare_exchange_n(&stats->max_imbalance_percent, &max,
+                                           imbalance_percent, true, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Maps integer keys to unsigned integers with the same order.
+ */
+template <class T, class Enable = void>
+struct RadixKey {
+    static constexpr const bool kSupported = false;
+};
+
+template <class T>
+struct RadixKey<T, std::enable_if_t<std::is_integral<T>::value
+                                    && !std::is_same<T, bool>::value
+                                    && sizeof(T) <= sizeof(std::uint64_t)>> {
+    static constexpr const bool kSupported = true;
+    using unsigned_type = std::make_unsigned_t<T>;
+
+    static unsigned_type toUnsigned(const T& key) {
+        constexpr const unsigned_type kSignBit = std::is_signed<T>::value
+                ? unsigned_type{1} << (std::numeric_limits<unsigned_type>::digits - 1)
+                : 0;
+        return static_cast<unsigned_type>(key) ^ kSignBit;
+    }
+};
+
+/**
+ * Maps IEEE-754 floating-point values to unsigned integers in total order:
+ * -inf < ... < -0.0 < +0.0 < ... < +inf, with all NaNs first or last.
+ */
+template <class T, nan_policy kNans>
+struct FloatKey {
+    static_assert(std::numeric_limits<T>::is_iec559
+                          && (sizeof(T) == sizeof(std::uint32_t)
+                              || sizeof(T) == sizeof(std::uint64_t)),
+                  "Total order sorting requires IEEE-754 float or double.");
+    using unsigned_type = std::conditional_t<sizeof(T) == sizeof(std::uint32_t),
+                                             std::uint32_t, std::uint64_t>;
+
+    unsigned_type operator()(const T& value) const {
+        constexpr const int kBits = std::numeric_limits<unsigned_type>::digits;
+        constexpr const unsigned_type kSignBit = unsigned_type{1} << (kBits - 1);
+        // Number of NaNs of each sign, which equals the key of -inf
+        constexpr const unsigned_type kNumNans =
+                (unsigned_type{1} << (std::numeric_limits<T>::digits - 1)) - 1;
+
+        unsigned_type bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        // Negative values reverse their order, positive values move above them
+        const unsigned_type mask = -(bits >> (kBits - 1)) | kSignBit;
+        const unsigned_type key = bits ^ mask;
+        // Rotate the NaNs of one sign past the NaNs of the other sign
+        return kNans == nan_policy::last ? key - kNumNans : key + kNumNans;
+    }
+};
+
 }  // namespace detail
 }  // namespace ips4o